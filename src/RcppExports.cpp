@@ -24,24 +24,55 @@ BEGIN_RCPP
 END_RCPP
 }
 // normalise_addr
-CharacterVector normalise_addr(CharacterVector addresses);
-RcppExport SEXP poster_normalise_addr(SEXP addressesSEXP) {
+CharacterVector normalise_addr(CharacterVector addresses, bool sanitise, std::string plan);
+RcppExport SEXP poster_normalise_addr(SEXP addressesSEXP, SEXP sanitiseSEXP, SEXP planSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
-    rcpp_result_gen = Rcpp::wrap(normalise_addr(addresses));
+    Rcpp::traits::input_parameter< bool >::type sanitise(sanitiseSEXP);
+    Rcpp::traits::input_parameter< std::string >::type plan(planSEXP);
+    rcpp_result_gen = Rcpp::wrap(normalise_addr(addresses, sanitise, plan));
     return rcpp_result_gen;
 END_RCPP
 }
 // parse_addr
-DataFrame parse_addr(CharacterVector addresses);
-RcppExport SEXP poster_parse_addr(SEXP addressesSEXP) {
+DataFrame parse_addr(CharacterVector addresses, bool sanitise, std::string plan, CharacterVector normalise, bool lazy);
+RcppExport SEXP poster_parse_addr(SEXP addressesSEXP, SEXP sanitiseSEXP, SEXP planSEXP, SEXP normaliseSEXP, SEXP lazySEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
-    rcpp_result_gen = Rcpp::wrap(parse_addr(addresses));
+    Rcpp::traits::input_parameter< bool >::type sanitise(sanitiseSEXP);
+    Rcpp::traits::input_parameter< std::string >::type plan(planSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type normalise(normaliseSEXP);
+    Rcpp::traits::input_parameter< bool >::type lazy(lazySEXP);
+    rcpp_result_gen = Rcpp::wrap(parse_addr(addresses, sanitise, plan, normalise, lazy));
+    return rcpp_result_gen;
+END_RCPP
+}
+// plan_addr_
+List plan_addr_(CharacterVector addresses, int mode, bool sanitise, CharacterVector normalise);
+RcppExport SEXP poster_plan_addr_(SEXP addressesSEXP, SEXP modeSEXP, SEXP sanitiseSEXP, SEXP normaliseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    Rcpp::traits::input_parameter< int >::type mode(modeSEXP);
+    Rcpp::traits::input_parameter< bool >::type sanitise(sanitiseSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type normalise(normaliseSEXP);
+    rcpp_result_gen = Rcpp::wrap(plan_addr_(addresses, mode, sanitise, normalise));
+    return rcpp_result_gen;
+END_RCPP
+}
+// sanitise_addr_
+CharacterVector sanitise_addr_(CharacterVector addresses);
+RcppExport SEXP poster_sanitise_addr_(SEXP addressesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    rcpp_result_gen = Rcpp::wrap(sanitise_addr_(addresses));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -58,15 +89,385 @@ BEGIN_RCPP
 END_RCPP
 }
 // set_elements_
-CharacterVector set_elements_(CharacterVector addresses, CharacterVector replacement, int element);
-RcppExport SEXP poster_set_elements_(SEXP addressesSEXP, SEXP replacementSEXP, SEXP elementSEXP) {
+CharacterVector set_elements_(CharacterVector addresses, CharacterVector replacement, int element, std::string country);
+RcppExport SEXP poster_set_elements_(SEXP addressesSEXP, SEXP replacementSEXP, SEXP elementSEXP, SEXP countrySEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
     Rcpp::traits::input_parameter< CharacterVector >::type replacement(replacementSEXP);
     Rcpp::traits::input_parameter< int >::type element(elementSEXP);
-    rcpp_result_gen = Rcpp::wrap(set_elements_(addresses, replacement, element));
+    Rcpp::traits::input_parameter< std::string >::type country(countrySEXP);
+    rcpp_result_gen = Rcpp::wrap(set_elements_(addresses, replacement, element, country));
+    return rcpp_result_gen;
+END_RCPP
+}
+// parse_tokens_
+List parse_tokens_(CharacterVector addresses);
+RcppExport SEXP poster_parse_tokens_(SEXP addressesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    rcpp_result_gen = Rcpp::wrap(parse_tokens_(addresses));
+    return rcpp_result_gen;
+END_RCPP
+}
+// compare_addr_
+DataFrame compare_addr_(CharacterVector a, CharacterVector b, bool expand);
+RcppExport SEXP poster_compare_addr_(SEXP aSEXP, SEXP bSEXP, SEXP expandSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type a(aSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type b(bSEXP);
+    Rcpp::traits::input_parameter< bool >::type expand(expandSEXP);
+    rcpp_result_gen = Rcpp::wrap(compare_addr_(a, b, expand));
+    return rcpp_result_gen;
+END_RCPP
+}
+// join_addr_
+DataFrame join_addr_(CharacterVector x, CharacterVector y, CharacterVector components, bool expand);
+RcppExport SEXP poster_join_addr_(SEXP xSEXP, SEXP ySEXP, SEXP componentsSEXP, SEXP expandSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type y(ySEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type components(componentsSEXP);
+    Rcpp::traits::input_parameter< bool >::type expand(expandSEXP);
+    rcpp_result_gen = Rcpp::wrap(join_addr_(x, y, components, expand));
+    return rcpp_result_gen;
+END_RCPP
+}
+// link_addr_
+SEXP link_addr_(CharacterVector x, SEXP y, List keys, bool expand, int window, double batch_size, SEXP callback);
+RcppExport SEXP poster_link_addr_(SEXP xSEXP, SEXP ySEXP, SEXP keysSEXP, SEXP expandSEXP, SEXP windowSEXP, SEXP batch_sizeSEXP, SEXP callbackSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type x(xSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type y(ySEXP);
+    Rcpp::traits::input_parameter< List >::type keys(keysSEXP);
+    Rcpp::traits::input_parameter< bool >::type expand(expandSEXP);
+    Rcpp::traits::input_parameter< int >::type window(windowSEXP);
+    Rcpp::traits::input_parameter< double >::type batch_size(batch_sizeSEXP);
+    Rcpp::traits::input_parameter< SEXP >::type callback(callbackSEXP);
+    rcpp_result_gen = Rcpp::wrap(link_addr_(x, y, keys, expand, window, batch_size, callback));
+    return rcpp_result_gen;
+END_RCPP
+}
+// format_addr_
+CharacterVector format_addr_(List components, CharacterVector countries, CharacterVector templates, std::string separator);
+RcppExport SEXP poster_format_addr_(SEXP componentsSEXP, SEXP countriesSEXP, SEXP templatesSEXP, SEXP separatorSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< List >::type components(componentsSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type countries(countriesSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type templates(templatesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type separator(separatorSEXP);
+    rcpp_result_gen = Rcpp::wrap(format_addr_(components, countries, templates, separator));
+    return rcpp_result_gen;
+END_RCPP
+}
+// store_build_
+SEXP store_build_(CharacterVector addresses, double memory_limit, std::string spill_dir);
+RcppExport SEXP poster_store_build_(SEXP addressesSEXP, SEXP memory_limitSEXP, SEXP spill_dirSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    Rcpp::traits::input_parameter< double >::type memory_limit(memory_limitSEXP);
+    Rcpp::traits::input_parameter< std::string >::type spill_dir(spill_dirSEXP);
+    rcpp_result_gen = Rcpp::wrap(store_build_(addresses, memory_limit, spill_dir));
+    return rcpp_result_gen;
+END_RCPP
+}
+// store_rows_
+DataFrame store_rows_(SEXP store, IntegerVector rows);
+RcppExport SEXP poster_store_rows_(SEXP storeSEXP, SEXP rowsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type store(storeSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type rows(rowsSEXP);
+    rcpp_result_gen = Rcpp::wrap(store_rows_(store, rows));
+    return rcpp_result_gen;
+END_RCPP
+}
+// store_info_
+List store_info_(SEXP store);
+RcppExport SEXP poster_store_info_(SEXP storeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type store(storeSEXP);
+    rcpp_result_gen = Rcpp::wrap(store_info_(store));
+    return rcpp_result_gen;
+END_RCPP
+}
+// store_format_
+CharacterVector store_format_(SEXP store, CharacterVector countries, CharacterVector templates, std::string separator);
+RcppExport SEXP poster_store_format_(SEXP storeSEXP, SEXP countriesSEXP, SEXP templatesSEXP, SEXP separatorSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type store(storeSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type countries(countriesSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type templates(templatesSEXP);
+    Rcpp::traits::input_parameter< std::string >::type separator(separatorSEXP);
+    rcpp_result_gen = Rcpp::wrap(store_format_(store, countries, templates, separator));
+    return rcpp_result_gen;
+END_RCPP
+}
+// store_save_
+void store_save_(SEXP store, std::string path);
+RcppExport SEXP poster_store_save_(SEXP storeSEXP, SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type store(storeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    store_save_(store, path);
+    return R_NilValue;
+END_RCPP
+}
+// store_load_
+SEXP store_load_(std::string path);
+RcppExport SEXP poster_store_load_(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(store_load_(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// warm_up_
+List warm_up_(std::string datadir, int rounds);
+RcppExport SEXP poster_warm_up_(SEXP datadirSEXP, SEXP roundsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type datadir(datadirSEXP);
+    Rcpp::traits::input_parameter< int >::type rounds(roundsSEXP);
+    rcpp_result_gen = Rcpp::wrap(warm_up_(datadir, rounds));
+    return rcpp_result_gen;
+END_RCPP
+}
+// time_rows_
+NumericVector time_rows_(CharacterVector addresses, int mode, int reps, bool sanitise, CharacterVector normalise);
+RcppExport SEXP poster_time_rows_(SEXP addressesSEXP, SEXP modeSEXP, SEXP repsSEXP, SEXP sanitiseSEXP, SEXP normaliseSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< CharacterVector >::type addresses(addressesSEXP);
+    Rcpp::traits::input_parameter< int >::type mode(modeSEXP);
+    Rcpp::traits::input_parameter< int >::type reps(repsSEXP);
+    Rcpp::traits::input_parameter< bool >::type sanitise(sanitiseSEXP);
+    Rcpp::traits::input_parameter< CharacterVector >::type normalise(normaliseSEXP);
+    rcpp_result_gen = Rcpp::wrap(time_rows_(addresses, mode, reps, sanitise, normalise));
+    return rcpp_result_gen;
+END_RCPP
+}
+// trim_buffers_
+double trim_buffers_();
+RcppExport SEXP poster_trim_buffers_() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(trim_buffers_());
+    return rcpp_result_gen;
+END_RCPP
+}
+// set_buffer_budget_
+void set_buffer_budget_(double bytes);
+RcppExport SEXP poster_set_buffer_budget_(SEXP bytesSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type bytes(bytesSEXP);
+    set_buffer_budget_(bytes);
+    return R_NilValue;
+END_RCPP
+}
+// set_resources_
+void set_resources_(double threads, double memory, bool cgroup);
+RcppExport SEXP poster_set_resources_(SEXP threadsSEXP, SEXP memorySEXP, SEXP cgroupSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< double >::type threads(threadsSEXP);
+    Rcpp::traits::input_parameter< double >::type memory(memorySEXP);
+    Rcpp::traits::input_parameter< bool >::type cgroup(cgroupSEXP);
+    set_resources_(threads, memory, cgroup);
+    return R_NilValue;
+END_RCPP
+}
+// resources_
+List resources_();
+RcppExport SEXP poster_resources_() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(resources_());
+    return rcpp_result_gen;
+END_RCPP
+}
+// memory_accounting_
+bool memory_accounting_(bool enabled);
+RcppExport SEXP poster_memory_accounting_(SEXP enabledSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< bool >::type enabled(enabledSEXP);
+    rcpp_result_gen = Rcpp::wrap(memory_accounting_(enabled));
     return rcpp_result_gen;
 END_RCPP
 }
+// memory_report_
+List memory_report_();
+RcppExport SEXP poster_memory_report_() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(memory_report_());
+    return rcpp_result_gen;
+END_RCPP
+}
+// trace_start_
+void trace_start_(int capacity);
+RcppExport SEXP poster_trace_start_(SEXP capacitySEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type capacity(capacitySEXP);
+    trace_start_(capacity);
+    return R_NilValue;
+END_RCPP
+}
+// trace_stop_
+double trace_stop_(std::string path);
+RcppExport SEXP poster_trace_stop_(SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(trace_stop_(path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// service_start_
+void service_start_(std::string path, double window, int max_batch, int workers, IntegerVector weights, NumericVector max_queue, double shed_bulk_at, double max_connections, bool sanitise);
+RcppExport SEXP poster_service_start_(SEXP pathSEXP, SEXP windowSEXP, SEXP max_batchSEXP, SEXP workersSEXP, SEXP weightsSEXP, SEXP max_queueSEXP, SEXP shed_bulk_atSEXP, SEXP max_connectionsSEXP, SEXP sanitiseSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< double >::type window(windowSEXP);
+    Rcpp::traits::input_parameter< int >::type max_batch(max_batchSEXP);
+    Rcpp::traits::input_parameter< int >::type workers(workersSEXP);
+    Rcpp::traits::input_parameter< IntegerVector >::type weights(weightsSEXP);
+    Rcpp::traits::input_parameter< NumericVector >::type max_queue(max_queueSEXP);
+    Rcpp::traits::input_parameter< double >::type shed_bulk_at(shed_bulk_atSEXP);
+    Rcpp::traits::input_parameter< double >::type max_connections(max_connectionsSEXP);
+    Rcpp::traits::input_parameter< bool >::type sanitise(sanitiseSEXP);
+    service_start_(path, window, max_batch, workers, weights, max_queue, shed_bulk_at, max_connections, sanitise);
+    return R_NilValue;
+END_RCPP
+}
+// service_stop_
+void service_stop_();
+RcppExport SEXP poster_service_stop_() {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    service_stop_();
+    return R_NilValue;
+END_RCPP
+}
+// service_info_
+List service_info_();
+RcppExport SEXP poster_service_info_() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(service_info_());
+    return rcpp_result_gen;
+END_RCPP
+}
+// service_load_test_
+List service_load_test_(std::string path, std::vector<std::string> addresses, int clients, int requests, int lane, int background);
+RcppExport SEXP poster_service_load_test_(SEXP pathSEXP, SEXP addressesSEXP, SEXP clientsSEXP, SEXP requestsSEXP, SEXP laneSEXP, SEXP backgroundSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type addresses(addressesSEXP);
+    Rcpp::traits::input_parameter< int >::type clients(clientsSEXP);
+    Rcpp::traits::input_parameter< int >::type requests(requestsSEXP);
+    Rcpp::traits::input_parameter< int >::type lane(laneSEXP);
+    Rcpp::traits::input_parameter< int >::type background(backgroundSEXP);
+    rcpp_result_gen = Rcpp::wrap(service_load_test_(path, addresses, clients, requests, lane, background));
+    return rcpp_result_gen;
+END_RCPP
+}
+// service_send_
+std::string service_send_(std::string path, std::string request);
+RcppExport SEXP poster_service_send_(SEXP pathSEXP, SEXP requestSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< std::string >::type request(requestSEXP);
+    rcpp_result_gen = Rcpp::wrap(service_send_(path, request));
+    return rcpp_result_gen;
+END_RCPP
+}
+// reload_models_
+List reload_models_(std::string datadir, int rounds);
+RcppExport SEXP poster_reload_models_(SEXP datadirSEXP, SEXP roundsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type datadir(datadirSEXP);
+    Rcpp::traits::input_parameter< int >::type rounds(roundsSEXP);
+    rcpp_result_gen = Rcpp::wrap(reload_models_(datadir, rounds));
+    return rcpp_result_gen;
+END_RCPP
+}
+// metrics_text_
+std::string metrics_text_();
+RcppExport SEXP poster_metrics_text_() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(metrics_text_());
+    return rcpp_result_gen;
+END_RCPP
+}
+// metrics_serve_
+void metrics_serve_(int port);
+RcppExport SEXP poster_metrics_serve_(SEXP portSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< int >::type port(portSEXP);
+    metrics_serve_(port);
+    return R_NilValue;
+END_RCPP
+}
+// metrics_write_
+void metrics_write_(std::string path, double interval);
+RcppExport SEXP poster_metrics_write_(SEXP pathSEXP, SEXP intervalSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type path(pathSEXP);
+    Rcpp::traits::input_parameter< double >::type interval(intervalSEXP);
+    metrics_write_(path, interval);
+    return R_NilValue;
+END_RCPP
+}
+// metrics_stop_
+void metrics_stop_();
+RcppExport SEXP poster_metrics_stop_() {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    metrics_stop_();
+    return R_NilValue;
+END_RCPP
+}
@@ -0,0 +1,149 @@
+#include "buffer_pool.h"
+#include "governor.h"
+
+std::atomic<size_t> buffer_pool::budget(64 * 1024 * 1024);
+std::atomic<uint64_t> buffer_pool::trim_generation(0);
+
+static thread_local scratch_buffers* thread_buffers[POSTER_POOLED_LEASES] = {};
+
+// The heap memory held by a string, of which one short enough for the
+// small-string optimisation holds none beyond its own footprint.
+static inline size_t heap_bytes(const poster_string& x){
+  static const size_t inline_capacity = poster_string().capacity();
+  return x.capacity() > inline_capacity ? x.capacity() : 0;
+}
+
+// The heap memory held by the strings of the first rows rows of buffers.
+static size_t strings_bytes(const scratch_buffers& buffers, size_t rows){
+  size_t bytes = 0;
+  for(size_t i = 0; i < std::min(rows, buffers.parsed.size()); i++){
+    for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+      bytes += heap_bytes(buffers.parsed[i].components[n]);
+    }
+  }
+  for(size_t i = 0; i < std::min(rows, buffers.strings.size()); i++){
+    bytes += heap_bytes(buffers.strings[i]);
+  }
+  for(size_t i = 0; i < std::min(rows, buffers.sanitised.size()); i++){
+    bytes += heap_bytes(buffers.sanitised[i]);
+  }
+  return bytes;
+}
+
+// Drops the buffers of a string that has grown too long to keep.
+static inline void trim_string(poster_string& x){
+  if(x.capacity() > POSTER_POOLED_STRING_MAX){
+    poster_string().swap(x);
+  }
+}
+
+// Drops the buffers of the first rows rows' strings that have grown too long.
+static void trim_strings(scratch_buffers& buffers, size_t rows){
+  for(size_t i = 0; i < std::min(rows, buffers.parsed.size()); i++){
+    for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+      trim_string(buffers.parsed[i].components[n]);
+    }
+  }
+  for(size_t i = 0; i < std::min(rows, buffers.strings.size()); i++){
+    trim_string(buffers.strings[i]);
+  }
+  for(size_t i = 0; i < std::min(rows, buffers.sanitised.size()); i++){
+    trim_string(buffers.sanitised[i]);
+  }
+}
+
+// The heap memory held by a thread's buffers, with their rows' strings as
+// they were last counted.
+size_t buffer_pool::retained(scratch_buffers& buffers){
+  return (buffers.inputs.capacity() * sizeof(const char*)) +
+    (buffers.parsed.capacity() * sizeof(parsed_address)) +
+    (buffers.strings.capacity() + buffers.sanitised.capacity()) * sizeof(poster_string) +
+    buffers.row_bytes + buffers.text.capacity() + buffers.transcoded.capacity();
+}
+
+void buffer_pool::shrink(scratch_buffers& buffers){
+  std::vector<const char*>().swap(buffers.inputs);
+  std::vector<parsed_address>().swap(buffers.parsed);
+  std::vector<poster_string>().swap(buffers.strings);
+  std::vector<poster_string>().swap(buffers.sanitised);
+  poster_string().swap(buffers.text);
+  poster_string().swap(buffers.transcoded);
+  buffers.row_bytes = 0;
+  resource_governor::release(buffers.granted);
+  buffers.granted = 0;
+}
+
+scratch_buffers* buffer_pool::acquire(bool& pooled, size_t rows){
+  scratch_buffers* buffers = NULL;
+  for(unsigned int n = 0; n < POSTER_POOLED_LEASES && buffers == NULL; n++){
+    if(thread_buffers[n] == NULL){
+      thread_buffers[n] = new scratch_buffers();
+      thread_buffers[n]->trim_generation = trim_generation;
+    }
+    if(!thread_buffers[n]->in_use){
+      buffers = thread_buffers[n];
+    }
+  }
+  pooled = buffers != NULL;
+  if(!pooled){
+    buffers = new scratch_buffers();
+  } else if(buffers->trim_generation != trim_generation){
+    shrink(*buffers);
+    buffers->trim_generation = trim_generation;
+  }
+  buffers->in_use = true;
+  if(buffers->inputs.size() < rows){
+    buffers->inputs.resize(rows);
+  }
+  if(buffers->parsed.size() < rows){
+    buffers->parsed.resize(rows);
+  }
+  if(buffers->strings.size() < rows){
+    buffers->strings.resize(rows);
+  }
+  // Only the rows leased can change, so only theirs are counted, now and as
+  // the lease ends.
+  buffers->lease_rows = rows;
+  buffers->lease_bytes = pooled ? strings_bytes(*buffers, rows) : 0;
+  return buffers;
+}
+
+void buffer_pool::release(scratch_buffers* buffers, bool pooled){
+  if(!pooled){
+    delete buffers;
+    return;
+  }
+  buffers->in_use = false;
+  trim_strings(*buffers, buffers->lease_rows);
+  trim_string(buffers->text);
+  buffers->row_bytes += strings_bytes(*buffers, buffers->lease_rows);
+  buffers->row_bytes -= std::min(buffers->lease_bytes, buffers->row_bytes);
+  // What is kept is granted afresh each time, all of it or none.
+  resource_governor::release(buffers->granted);
+  buffers->granted = retained(*buffers);
+  if(buffers->granted > budget || !resource_governor::reserve_all(buffers->granted)){
+    buffers->granted = 0;
+    shrink(*buffers);
+  }
+}
+
+void buffer_pool::set_budget(size_t bytes){
+  budget = bytes;
+}
+
+// Trims the calling thread's buffers now, and every other thread's the next
+// time it uses them. Returns the bytes released on the calling thread.
+size_t buffer_pool::trim(){
+  trim_generation++;
+  size_t bytes = 0;
+  for(unsigned int n = 0; n < POSTER_POOLED_LEASES; n++){
+    scratch_buffers* buffers = thread_buffers[n];
+    if(buffers == NULL || buffers->in_use){
+      continue;
+    }
+    bytes += retained(*buffers);
+    shrink(*buffers);
+    buffers->trim_generation = trim_generation;
+  }
+  return bytes;
+}
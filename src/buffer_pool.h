@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <vector>
+#include "core.h"
+
+#ifndef __POSTER_BUFFER_POOL__
+#define __POSTER_BUFFER_POOL__
+
+// Strings that have grown beyond this are dropped rather than kept, so a
+// single long address can't pin a large buffer for good.
+#define POSTER_POOLED_STRING_MAX 1024
+
+// How many leases a thread can hold at once on buffers it keeps between
+// calls, so that a call that leases a second set (as compare_addr does, a
+// set for each side) reuses that one too. Leases nested deeper get buffers
+// of their own.
+#define POSTER_POOLED_LEASES 2
+
+// The scratch space a call needs for a chunk of rows. row_bytes is the heap
+// memory held by the strings of its rows, as of the last lease's end, and
+// lease_bytes those of the rows the current lease uses, as it began, so that
+// ending a lease only has to look at the rows it used.
+struct scratch_buffers {
+  std::vector<const char*> inputs;
+  std::vector<parsed_address> parsed;
+  std::vector<poster_string> strings;
+  std::vector<poster_string> sanitised;
+  poster_string text;
+  poster_string transcoded;
+  uint64_t trim_generation;
+  size_t granted;
+  size_t row_bytes;
+  size_t lease_rows;
+  size_t lease_bytes;
+  bool in_use;
+  scratch_buffers() : trim_generation(0), granted(0), row_bytes(0), lease_rows(0), lease_bytes(0),
+    in_use(false) {}
+};
+
+// The rows a call of input_size rows, run chunk_size at a time, needs to
+// lease: never none, so that its first row's buffers are always there.
+static inline size_t chunk_rows(size_t input_size, size_t chunk_size){
+  return std::max((size_t) 1, std::min(input_size, chunk_size));
+}
+
+// Scratch buffers kept per thread between calls, so that a thread serving
+// call after call reuses the strings and rows of earlier ones rather than
+// allocating them afresh. A thread's buffers are trimmed back when they hold
+// more than the budget, or than the resource governor will grant them, or
+// when trim() has been called since it last used them. Rather than pools of
+// buffers by size class shared between threads, each thread keeps a set (or
+// POSTER_POOLED_LEASES of them) sized for the most rows it has leased, which
+// needs no lock to take or give back.
+class buffer_pool {
+
+private:
+
+  static std::atomic<size_t> budget;
+  static std::atomic<uint64_t> trim_generation;
+
+  static size_t retained(scratch_buffers& buffers);
+
+  static void shrink(scratch_buffers& buffers);
+
+public:
+
+  // Leases buffers with room for rows rows, which is all of them the call
+  // may use.
+  static scratch_buffers* acquire(bool& pooled, size_t rows);
+
+  static void release(scratch_buffers* buffers, bool pooled);
+
+  static void set_budget(size_t bytes);
+
+  static size_t trim();
+
+};
+
+// A call's lease on its thread's buffers, sized for a chunk of rows; the
+// call uses none beyond them. Leases nested deeper than the thread keeps
+// buffers for get buffers of their own.
+class scratch_lease {
+
+private:
+
+  scratch_buffers* buffers;
+  bool pooled;
+
+public:
+
+  scratch_lease(size_t rows) {
+    buffers = buffer_pool::acquire(pooled, rows);
+  }
+
+  ~scratch_lease(){
+    buffer_pool::release(buffers, pooled);
+  }
+
+  scratch_buffers* operator->(){
+    return buffers;
+  }
+
+  scratch_buffers& operator*(){
+    return *buffers;
+  }
+
+};
+
+#endif
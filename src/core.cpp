@@ -0,0 +1,474 @@
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "core.h"
+#include "metrics.h"
+
+const char* label_names[PARSER_LABEL_COUNT] = {
+  "house",
+  "category",
+  "near",
+  "house_number",
+  "road",
+  "unit",
+  "level",
+  "staircase",
+  "entrance",
+  "po_box",
+  "postcode",
+  "suburb",
+  "city_district",
+  "city",
+  "island",
+  "state_district",
+  "state",
+  "country_region",
+  "country",
+  "world_region"
+};
+
+const uint16_t label_components[PARSER_LABEL_COUNT] = {
+  LIBPOSTAL_ADDRESS_NAME,
+  LIBPOSTAL_ADDRESS_CATEGORY,
+  LIBPOSTAL_ADDRESS_NEAR,
+  LIBPOSTAL_ADDRESS_HOUSE_NUMBER,
+  LIBPOSTAL_ADDRESS_STREET,
+  LIBPOSTAL_ADDRESS_UNIT,
+  LIBPOSTAL_ADDRESS_LEVEL,
+  LIBPOSTAL_ADDRESS_STAIRCASE,
+  LIBPOSTAL_ADDRESS_ENTRANCE,
+  LIBPOSTAL_ADDRESS_PO_BOX,
+  LIBPOSTAL_ADDRESS_POSTAL_CODE,
+  LIBPOSTAL_ADDRESS_TOPONYM,
+  LIBPOSTAL_ADDRESS_TOPONYM,
+  LIBPOSTAL_ADDRESS_TOPONYM,
+  LIBPOSTAL_ADDRESS_TOPONYM,
+  LIBPOSTAL_ADDRESS_TOPONYM,
+  LIBPOSTAL_ADDRESS_TOPONYM,
+  LIBPOSTAL_ADDRESS_TOPONYM,
+  LIBPOSTAL_ADDRESS_TOPONYM,
+  LIBPOSTAL_ADDRESS_TOPONYM
+};
+
+const char* status_names[POSTER_STATUS_COUNT] = {
+  "ok",
+  "retried",
+  "invalid_utf8",
+  "failed"
+};
+
+std::mutex libpostal_mutex;
+
+std::atomic<uint64_t> model_version(0);
+
+std::string model_datadir;
+
+bool poster_setup(const std::string& datadir){
+  bool loaded;
+  if(datadir.empty()){
+    loaded = libpostal_setup() && libpostal_setup_language_classifier() && libpostal_setup_parser();
+  } else {
+    char* dir = (char*) datadir.c_str();
+    loaded = libpostal_setup_datadir(dir) && libpostal_setup_language_classifier_datadir(dir) &&
+      libpostal_setup_parser_datadir(dir);
+  }
+  if(loaded){
+    model_datadir = datadir;
+  }
+  return loaded;
+}
+
+void poster_teardown(){
+  libpostal_teardown();
+  libpostal_teardown_language_classifier();
+  libpostal_teardown_parser();
+}
+
+// The size of a parser response, for memory accounting.
+static size_t response_bytes(libpostal_address_parser_response_t* parsed){
+  size_t bytes = sizeof(libpostal_address_parser_response_t) + (2 * parsed->num_components * sizeof(char*));
+  for(unsigned int n = 0; n < parsed->num_components; n++){
+    bytes += strlen(parsed->components[n]) + strlen(parsed->labels[n]) + 2;
+  }
+  return bytes;
+}
+
+// Likewise for the result of an expansion.
+static size_t expansion_bytes(char** expansions, size_t num_expansions){
+  size_t bytes = num_expansions * sizeof(char*);
+  for(unsigned int n = 0; n < num_expansions; n++){
+    bytes += strlen(expansions[n]) + 1;
+  }
+  return bytes;
+}
+
+int label_index(const char* label){
+  switch(label[0]){
+  case 'c':
+    if(strcmp(label, "category") == 0) return PARSER_LABEL_CATEGORY;
+    if(strcmp(label, "city") == 0) return PARSER_LABEL_CITY;
+    if(strcmp(label, "city_district") == 0) return PARSER_LABEL_CITY_DISTRICT;
+    if(strcmp(label, "country") == 0) return PARSER_LABEL_COUNTRY;
+    if(strcmp(label, "country_region") == 0) return PARSER_LABEL_COUNTRY_REGION;
+    break;
+  case 'e':
+    if(strcmp(label, "entrance") == 0) return PARSER_LABEL_ENTRANCE;
+    break;
+  case 'h':
+    if(strcmp(label, "house") == 0) return PARSER_LABEL_HOUSE;
+    if(strcmp(label, "house_number") == 0) return PARSER_LABEL_HOUSE_NUMBER;
+    break;
+  case 'i':
+    if(strcmp(label, "island") == 0) return PARSER_LABEL_ISLAND;
+    break;
+  case 'l':
+    if(strcmp(label, "level") == 0) return PARSER_LABEL_LEVEL;
+    break;
+  case 'n':
+    if(strcmp(label, "near") == 0) return PARSER_LABEL_NEAR;
+    break;
+  case 'p':
+    if(strcmp(label, "postcode") == 0) return PARSER_LABEL_POSTCODE;
+    if(strcmp(label, "po_box") == 0) return PARSER_LABEL_PO_BOX;
+    break;
+  case 'r':
+    if(strcmp(label, "road") == 0) return PARSER_LABEL_ROAD;
+    break;
+  case 's':
+    if(strcmp(label, "suburb") == 0) return PARSER_LABEL_SUBURB;
+    if(strcmp(label, "state") == 0) return PARSER_LABEL_STATE;
+    if(strcmp(label, "state_district") == 0) return PARSER_LABEL_STATE_DISTRICT;
+    if(strcmp(label, "staircase") == 0) return PARSER_LABEL_STAIRCASE;
+    break;
+  case 'u':
+    if(strcmp(label, "unit") == 0) return PARSER_LABEL_UNIT;
+    break;
+  case 'w':
+    if(strcmp(label, "world_region") == 0) return PARSER_LABEL_WORLD_REGION;
+    break;
+  }
+  return -1;
+}
+
+size_t poster_ascii_prefix(const char* x, size_t size){
+  const uint64_t high_bits = 0x8080808080808080ULL;
+  size_t i = 0;
+  for(; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)){
+    uint64_t word;
+    memcpy(&word, x + i, sizeof(word));
+    if(word & high_bits){
+      break;
+    }
+  }
+  while(i < size && (unsigned char) x[i] < 0x80){
+    i++;
+  }
+  return i;
+}
+
+size_t poster_utf8_decode(const unsigned char* s, size_t remaining, uint32_t& code_point){
+  unsigned char c = s[0];
+  size_t length;
+  if(c < 0x80){
+    code_point = c;
+    return 1;
+  } else if((c & 0xE0) == 0xC0){
+    length = 2;
+    code_point = c & 0x1F;
+  } else if((c & 0xF0) == 0xE0){
+    length = 3;
+    code_point = c & 0x0F;
+  } else if((c & 0xF8) == 0xF0){
+    length = 4;
+    code_point = c & 0x07;
+  } else {
+    return 0;
+  }
+  if(remaining < length){
+    return 0;
+  }
+  for(size_t n = 1; n < length; n++){
+    if((s[n] & 0xC0) != 0x80){
+      return 0;
+    }
+    code_point = (code_point << 6) | (s[n] & 0x3F);
+  }
+  static const uint32_t smallest[5] = {0, 0, 0x80, 0x800, 0x10000};
+  if(code_point < smallest[length] || code_point > 0x10FFFF ||
+     (code_point >= 0xD800 && code_point <= 0xDFFF)){
+    return 0;
+  }
+  return length;
+}
+
+uint32_t poster_lower(uint32_t code_point){
+  if(code_point < 0x80){
+    return (code_point >= 'A' && code_point <= 'Z') ? code_point + 0x20 : code_point;
+  }
+  if((code_point >= 0xC0 && code_point <= 0xDE && code_point != 0xD7) ||
+     (code_point >= 0x391 && code_point <= 0x3AB && code_point != 0x3A2) ||
+     (code_point >= 0x410 && code_point <= 0x42F)){
+    return code_point + 0x20;
+  }
+  if(code_point >= 0x400 && code_point <= 0x40F){
+    return code_point + 0x50;
+  }
+  // Latin Extended-A and Additional, and Cyrillic from U+0460, pair each
+  // capital with the small letter after it, the capital's parity depending
+  // on the run.
+  if((code_point >= 0x100 && code_point <= 0x12F) || (code_point >= 0x132 && code_point <= 0x137) || (code_point >= 0x14A && code_point <= 0x177) ||
+     (code_point >= 0x460 && code_point <= 0x481) || (code_point >= 0x48A && code_point <= 0x4BF) ||
+     (code_point >= 0x4D0 && code_point <= 0x52F) || (code_point >= 0x1E00 && code_point <= 0x1E95) ||
+     (code_point >= 0x1EA0 && code_point <= 0x1EFF)){
+    return code_point | 1;
+  }
+  if((code_point >= 0x139 && code_point <= 0x148) || (code_point >= 0x179 && code_point <= 0x17E) ||
+     (code_point >= 0x4C1 && code_point <= 0x4CE)){
+    return (code_point & 1) ? code_point + 1 : code_point;
+  }
+  switch(code_point){
+  case 0x130: return 'i';
+  case 0x178: return 0xFF;
+  case 0x386: return 0x3AC;
+  case 0x388: case 0x389: case 0x38A: return code_point + 0x25;
+  case 0x38C: return 0x3CC;
+  case 0x38E: case 0x38F: return code_point + 0x3F;
+  case 0x4C0: return 0x4CF;
+  case 0x1E9E: return 0xDF;
+  }
+  return code_point;
+}
+
+bool poster_valid_utf8(const char* x, size_t size){
+  const unsigned char* s = (const unsigned char*) x;
+  uint32_t code_point;
+  size_t i = poster_ascii_prefix(x, size);
+  while(i < size){
+    if(s[i] < 0x80){
+      i += poster_ascii_prefix(x + i, size - i);
+      continue;
+    }
+    size_t length = poster_utf8_decode(s + i, size - i, code_point);
+    if(length == 0){
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+void poster_scrub(const char* x, poster_string& output, std::vector<size_t>* sources){
+  const unsigned char* s = (const unsigned char*) x;
+  size_t size = strlen(x);
+  output.clear();
+  if(sources != NULL){
+    sources->clear();
+  }
+  size_t i = 0;
+  while(i < size){
+    uint32_t code_point;
+    size_t length = poster_utf8_decode(s + i, size - i, code_point);
+    size_t kept = output.size();
+    if(length == 0){
+      i++;
+      continue;
+    } else if(length > 1){
+      output.append(x + i, length);
+    } else if(s[i] == '\t' || s[i] == '\n' || s[i] == '\r'){
+      output.push_back(' ');
+    } else if(s[i] >= 0x20 && s[i] != 0x7F){
+      output.push_back(s[i]);
+    }
+    if(sources != NULL){
+      for(size_t n = kept; n < output.size(); n++){
+        sources->push_back(i + n - kept);
+      }
+    }
+    i += length;
+  }
+}
+
+// Runs x through libpostal's parser, counting and tracing it. Returns NULL if
+// libpostal failed.
+static libpostal_address_parser_response_t* parse_response(const char* x, libpostal_address_parser_options_t& opts){
+  POSTER_PROBE1(parse_start, x);
+  std::unique_lock<std::mutex> lock(libpostal_mutex);
+  libpostal_address_parser_response_t *parsed = libpostal_parse_address((char*) x, opts);
+  lock.unlock();
+  metrics::count(COUNTER_ROWS_PARSED);
+  if(parsed == NULL){
+    POSTER_PROBE2(parse_end, x, 0);
+    return NULL;
+  }
+  POSTER_PROBE2(parse_end, x, parsed->num_components);
+  memory_accounting::count_libpostal(response_bytes(parsed));
+  return parsed;
+}
+
+int poster_parse(const char* x, libpostal_address_parser_options_t& opts, parsed_address& output){
+
+  stage_scope scope(STAGE_PARSE);
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    output.components[n].clear();
+  }
+
+  if(!poster_valid_utf8(x, strlen(x))){
+    return POSTER_STATUS_INVALID_UTF8;
+  }
+  libpostal_address_parser_response_t *parsed = parse_response(x, opts);
+  if(parsed == NULL){
+    return POSTER_STATUS_FAILED;
+  }
+  for (unsigned int n = 0; n < parsed->num_components; n++) {
+    int label = label_index(parsed->labels[n]);
+    if(label >= 0){
+      output.components[label] = parsed->components[n];
+    }
+  }
+
+  libpostal_address_parser_response_destroy(parsed);
+  return POSTER_STATUS_OK;
+}
+
+int poster_parse_tokens(const char* x, libpostal_address_parser_options_t& opts, parsed_tokens& output){
+
+  stage_scope scope(STAGE_PARSE);
+  output.labels.clear();
+  output.ends.clear();
+  output.text.clear();
+
+  if(!poster_valid_utf8(x, strlen(x))){
+    return POSTER_STATUS_INVALID_UTF8;
+  }
+  libpostal_address_parser_response_t *parsed = parse_response(x, opts);
+  if(parsed == NULL){
+    return POSTER_STATUS_FAILED;
+  }
+  for (unsigned int n = 0; n < parsed->num_components; n++) {
+    output.labels.push_back(label_index(parsed->labels[n]));
+    output.text += parsed->components[n];
+    output.ends.push_back(output.text.size());
+  }
+
+  libpostal_address_parser_response_destroy(parsed);
+  return POSTER_STATUS_OK;
+}
+
+bool poster_expand(const char* x, libpostal_normalize_options_t& opts, poster_string& output, int* status){
+
+  size_t num_expansions = 0;
+  output.clear();
+  if(!poster_valid_utf8(x, strlen(x))){
+    if(status != NULL){
+      *status = POSTER_STATUS_INVALID_UTF8;
+    }
+    return false;
+  }
+  POSTER_PROBE1(expand_start, x);
+  std::unique_lock<std::mutex> lock(libpostal_mutex);
+  char **expansions = libpostal_expand_address((char*) x, opts, &num_expansions);
+  lock.unlock();
+  metrics::count(COUNTER_ROWS_NORMALISED);
+  if(status != NULL){
+    *status = (expansions == NULL) ? POSTER_STATUS_FAILED : POSTER_STATUS_OK;
+  }
+  if(expansions == NULL){
+    POSTER_PROBE2(expand_end, x, 0);
+    return false;
+  }
+  POSTER_PROBE2(expand_end, x, num_expansions);
+  memory_accounting::count_libpostal(expansion_bytes(expansions, num_expansions));
+  if(num_expansions > 0){
+    output = expansions[0];
+  }
+  libpostal_expansion_array_destroy(expansions, num_expansions);
+  return num_expansions > 0;
+}
+
+void poster_fold(const poster_string& x, poster_string& output){
+  output.clear();
+  bool space = false;
+  for(size_t i = 0; i < x.size(); i++){
+    unsigned char c = x[i];
+    if(c < 0x80 && !isalnum(c)){
+      space = !output.empty();
+      continue;
+    }
+    if(space){
+      output.push_back(' ');
+      space = false;
+    }
+    output.push_back((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+  }
+}
+
+static size_t prefetched_files;
+static size_t prefetched_bytes;
+
+static int prefetch_file(const char* path, const struct stat* info, int type, struct FTW*){
+  if(type != FTW_F){
+    return 0;
+  }
+  int fd = open(path, O_RDONLY);
+  if(fd < 0){
+    return 0;
+  }
+#ifdef POSIX_FADV_WILLNEED
+  posix_fadvise(fd, 0, info->st_size, POSIX_FADV_WILLNEED);
+#endif
+  close(fd);
+  prefetched_files++;
+  prefetched_bytes += info->st_size;
+  return 0;
+}
+
+size_t poster_prefetch(const char* dir, size_t& bytes){
+  prefetched_files = 0;
+  prefetched_bytes = 0;
+  nftw(dir, prefetch_file, 16, FTW_PHYS);
+  bytes += prefetched_bytes;
+  return prefetched_files;
+}
+
+// Addresses covering the scripts and languages libpostal is most often asked
+// about, so that warming up touches a representative share of its models.
+static const char* warm_up_addresses[] = {
+  "781 Franklin Ave Crown Heights Brooklyn NYC NY 11216 USA",
+  "Flat 2, 10 Downing Street, London SW1A 2AA, United Kingdom",
+  "Quatre-vingt-douze Ave des Champs-\u00c9lys\u00e9es, 75008 Paris",
+  "Platz der Republik 1, 11011 Berlin, Deutschland",
+  "Calle de Alcal\u00e1 42, 28014 Madrid, Espa\u00f1a",
+  "Via del Corso 12, 00186 Roma RM, Italia",
+  "Avenida Paulista 1578, Bela Vista, S\u00e3o Paulo - SP, 01310-200, Brasil",
+  "Damrak 1, 1012 LG Amsterdam, Nederland",
+  "\u0443\u043b. \u0422\u0432\u0435\u0440\u0441\u043a\u0430\u044f, 13, \u041c\u043e\u0441\u043a\u0432\u0430, 125009",
+  "\u3012100-0005 \u6771\u4eac\u90fd\u5343\u4ee3\u7530\u533a\u4e38\u306e\u5185\uff11\u4e01\u76ee",
+  "\u5317\u4eac\u5e02\u671d\u9633\u533a\u5efa\u56fd\u8def88\u53f7",
+  "\uc11c\uc6b8\ud2b9\ubcc4\uc2dc \uc885\ub85c\uad6c \uc138\uc885\ub300\ub85c 175",
+  "\u0634\u0627\u0631\u0639 \u0627\u0644\u062a\u062d\u0631\u064a\u0631 15\u060c \u0627\u0644\u0642\u0627\u0647\u0631\u0629",
+  "\u0930\u093e\u091c\u092a\u0925, \u0928\u0908 \u0926\u093f\u0932\u094d\u0932\u0940 110001",
+  "\u039b\u03b5\u03c9\u03c6\u03cc\u03c1\u03bf\u03c2 \u0391\u03bc\u03b1\u03bb\u03af\u03b1\u03c2 12, \u0391\u03b8\u03ae\u03bd\u03b1 105 57",
+  "\u0130stiklal Caddesi No:45, Beyo\u011flu, \u0130stanbul",
+  "ul. Marsza\u0142kowska 84/92, 00-514 Warszawa, Polska",
+  "Drottninggatan 53, 111 21 Stockholm, Sverige",
+  "1600 Pennsylvania Ave NW, Washington, DC 20500",
+  "PO Box 1234, Sydney NSW 2001, Australia"
+};
+
+size_t poster_warm_up(int rounds){
+  libpostal_address_parser_options_t parser_options = libpostal_get_address_parser_default_options();
+  libpostal_normalize_options_t normalize_options = libpostal_get_default_options();
+  size_t count = sizeof(warm_up_addresses) / sizeof(warm_up_addresses[0]);
+  parsed_address parsed;
+  poster_string expanded;
+  for(int round = 0; round < rounds; round++){
+    for(size_t i = 0; i < count; i++){
+      poster_parse(warm_up_addresses[i], parser_options, parsed);
+      poster_expand(warm_up_addresses[i], normalize_options, expanded);
+    }
+  }
+  return rounds * count;
+}
@@ -0,0 +1,144 @@
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <libpostal/libpostal.h>
+#include "instrument.h"
+#include "probes.h"
+
+#ifndef __POSTER_CORE__
+#define __POSTER_CORE__
+
+enum {
+    PARSER_LABEL_HOUSE,
+    PARSER_LABEL_CATEGORY,
+    PARSER_LABEL_NEAR,
+    PARSER_LABEL_HOUSE_NUMBER,
+    PARSER_LABEL_ROAD,
+    PARSER_LABEL_UNIT,
+    PARSER_LABEL_LEVEL,
+    PARSER_LABEL_STAIRCASE,
+    PARSER_LABEL_ENTRANCE,
+    PARSER_LABEL_PO_BOX,
+    PARSER_LABEL_POSTCODE,
+    PARSER_LABEL_SUBURB,
+    PARSER_LABEL_CITY_DISTRICT,
+    PARSER_LABEL_CITY,
+    PARSER_LABEL_ISLAND,
+    PARSER_LABEL_STATE_DISTRICT,
+    PARSER_LABEL_STATE,
+    PARSER_LABEL_COUNTRY_REGION,
+    PARSER_LABEL_COUNTRY,
+    PARSER_LABEL_WORLD_REGION,
+    PARSER_LABEL_COUNT
+};
+
+// libpostal's name for each label.
+extern const char* label_names[PARSER_LABEL_COUNT];
+
+// The LIBPOSTAL_ADDRESS_ component each label is normalised as.
+extern const uint16_t label_components[PARSER_LABEL_COUNT];
+
+// The ways an address can be run through libpostal.
+#define POSTER_MODE_PARSE 0
+#define POSTER_MODE_NORMALISE 1
+
+// What became of a row: run, run after failing the first time, or not run
+// because it wasn't valid UTF-8 or libpostal failed on it.
+#define POSTER_STATUS_OK 0
+#define POSTER_STATUS_RETRIED 1
+#define POSTER_STATUS_INVALID_UTF8 2
+#define POSTER_STATUS_FAILED 3
+#define POSTER_STATUS_COUNT 4
+
+extern const char* status_names[POSTER_STATUS_COUNT];
+
+// libpostal isn't safe to call from more than one thread at once, so every
+// call into it from here holds this.
+extern std::mutex libpostal_mutex;
+
+// Counts the times libpostal's models have been reloaded, so that anything
+// derived from them can tell which models it came from.
+extern std::atomic<uint64_t> model_version;
+
+// The data directory this process's models were last loaded from, or empty
+// for libpostal's own. Held under libpostal_mutex.
+extern std::string model_datadir;
+
+// Loads libpostal's models from datadir, or from wherever libpostal was
+// configured to find them if it is empty, returning false if that failed.
+bool poster_setup(const std::string& datadir);
+
+// Unloads libpostal's models.
+void poster_teardown();
+
+// An address parsed into its components, held natively so that it can be
+// built without touching R. Components libpostal didn't find are empty.
+struct parsed_address {
+  poster_string components[PARSER_LABEL_COUNT];
+};
+
+// An address parsed into the ordered sequence of components libpostal
+// labelled, which may label more than one component the same way. Each
+// component's label is its PARSER_LABEL_, or -1 if it isn't one, and its text
+// ends at its entry in ends within text, where the components are packed
+// end to end.
+struct parsed_tokens {
+  std::vector<int> labels;
+  std::vector<size_t> ends;
+  poster_string text;
+};
+
+// Maps one of libpostal's labels to its PARSER_LABEL_, or -1 if it isn't one.
+int label_index(const char* label);
+
+// The length of the run of ASCII at the start of the size bytes at x, found a
+// word at a time.
+size_t poster_ascii_prefix(const char* x, size_t size);
+
+// Decodes the UTF-8 sequence at s, of which remaining bytes are left, into
+// code_point, returning its length or 0 if it isn't valid: overlong forms,
+// surrogates and code points past U+10FFFF are all invalid.
+size_t poster_utf8_decode(const unsigned char* s, size_t remaining, uint32_t& code_point);
+
+// The simple lowercase of code_point, for capitals in the Latin (including
+// Latin-1 and Vietnamese), Greek and Cyrillic blocks; any other code point is
+// returned as it is.
+uint32_t poster_lower(uint32_t code_point);
+
+// Whether the size bytes at x are valid UTF-8.
+bool poster_valid_utf8(const char* x, size_t size);
+
+// Writes x into output without any invalid UTF-8 sequences or control
+// characters, which are dropped, or tabs and line breaks, which become spaces.
+// If sources is given, it is set to where in x each byte of output came from.
+void poster_scrub(const char* x, poster_string& output, std::vector<size_t>* sources = NULL);
+
+// Parses x into output, returning a POSTER_STATUS_; if it isn't
+// POSTER_STATUS_OK, output is empty. This and poster_expand don't touch R, so
+// they can be used outside of it.
+int poster_parse(const char* x, libpostal_address_parser_options_t& opts, parsed_address& output);
+
+// Parses x into output, keeping every component in order.
+int poster_parse_tokens(const char* x, libpostal_address_parser_options_t& opts, parsed_tokens& output);
+
+// Writes the first expansion of x into output, returning false if there
+// wasn't one, and setting status, if given, to a POSTER_STATUS_.
+bool poster_expand(const char* x, libpostal_normalize_options_t& opts, poster_string& output,
+                   int* status = NULL);
+
+// Writes a cheap comparison key for x into output: ASCII letters lowercased,
+// ASCII punctuation treated as space, and runs of space collapsed and trimmed.
+// Bytes outside ASCII are kept as they are.
+void poster_fold(const poster_string& x, poster_string& output);
+
+// Asks the kernel to read every file under dir into the page cache ahead of
+// use, returning the number of files and adding their size to bytes.
+size_t poster_prefetch(const char* dir, size_t& bytes);
+
+// Runs a synthetic set of addresses in a range of languages and scripts
+// through the parser and normaliser rounds times, so the pages of libpostal's
+// models are touched before real work arrives. Returns the rows processed.
+size_t poster_warm_up(int rounds);
+
+#endif
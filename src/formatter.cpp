@@ -0,0 +1,203 @@
+#include <cctype>
+#include <cstring>
+#include "formatter.h"
+
+component_view::component_view(){
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    data[n] = NULL;
+    size[n] = 0;
+  }
+}
+
+void component_view::set(const parsed_address& parsed){
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    data[n] = parsed.components[n].data();
+    size[n] = parsed.components[n].size();
+  }
+}
+
+// Maps a component's name in a template to its label, accepting parse_addr's
+// column name for the one that differs from libpostal's.
+static int template_label(const std::string& name){
+  if(name == "postal_code"){
+    return PARSER_LABEL_POSTCODE;
+  }
+  return label_index(name.c_str());
+}
+
+bool address_template::compile(const std::string& source, std::string& error){
+  lines.clear();
+  lines.push_back(std::vector<piece>());
+  piece literal;
+  literal.label = -1;
+  for(size_t i = 0; i < source.size(); i++){
+    char c = source[i];
+    if(c == '\n'){
+      if(!literal.text.empty()){
+        lines.back().push_back(literal);
+        literal.text.clear();
+      }
+      lines.push_back(std::vector<piece>());
+    } else if(c == '{'){
+      size_t close = source.find('}', i);
+      if(close == std::string::npos){
+        error = "unclosed { in template \"" + source + "\"";
+        return false;
+      }
+      std::string name = source.substr(i + 1, close - i - 1);
+      piece slot;
+      slot.label = template_label(name);
+      if(slot.label < 0){
+        error = "unknown component {" + name + "} in template \"" + source + "\"";
+        return false;
+      }
+      if(!literal.text.empty()){
+        lines.back().push_back(literal);
+        literal.text.clear();
+      }
+      lines.back().push_back(slot);
+      i = close;
+    } else {
+      literal.text.push_back(c);
+    }
+  }
+  if(!literal.text.empty()){
+    lines.back().push_back(literal);
+  }
+  return true;
+}
+
+size_t address_template::render(const component_view& components, const std::string& separator,
+                                char* output) const {
+  size_t written = 0;
+  bool any_line = false;
+  for(size_t l = 0; l < lines.size(); l++){
+    const std::vector<piece>& line = lines[l];
+    size_t first_slot = line.size(), last_slot = line.size();
+    size_t first = line.size(), last = line.size();
+    for(size_t p = 0; p < line.size(); p++){
+      if(line[p].label < 0){
+        continue;
+      }
+      if(first_slot == line.size()){
+        first_slot = p;
+      }
+      last_slot = p;
+      if(components.size[line[p].label] > 0){
+        if(first == line.size()){
+          first = p;
+        }
+        last = p;
+      }
+    }
+    if(first == line.size()){
+      continue;
+    }
+    if(any_line){
+      if(output != NULL){
+        memcpy(output + written, separator.data(), separator.size());
+      }
+      written += separator.size();
+    }
+    any_line = true;
+    // Text before every slot or after every slot is kept with the line; text
+    // between them only once a component has been written since the last.
+    bool pending = false;
+    for(size_t p = 0; p < line.size(); p++){
+      const char* data;
+      size_t size;
+      if(line[p].label < 0){
+        bool edge = p < first_slot || p > last_slot;
+        if(!edge && !(pending && p > first && p < last)){
+          continue;
+        }
+        data = line[p].text.data();
+        size = line[p].text.size();
+        pending = false;
+      } else {
+        size = components.size[line[p].label];
+        if(size == 0){
+          continue;
+        }
+        data = components.data[line[p].label];
+        pending = true;
+      }
+      if(output != NULL){
+        memcpy(output + written, data, size);
+      }
+      written += size;
+    }
+  }
+  return written;
+}
+
+void address_template::render(const component_view& components, const std::string& separator,
+                              poster_string& output) const {
+  output.resize(render(components, separator, NULL));
+  if(!output.empty()){
+    render(components, separator, &output[0]);
+  }
+}
+
+// poster's own templates, after the postal conventions of each country.
+static const char* builtin_templates[][2] = {
+  {"default", "{house}\n{house_number} {road}\n{unit}\n{suburb}\n{city} {state} {postcode}\n{country}"},
+  {"US", "{house}\n{house_number} {road} {unit}\n{suburb}\n{city}, {state} {postcode}\n{country}"},
+  {"CA", "{house}\n{unit}-{house_number} {road}\n{city} {state} {postcode}\n{country}"},
+  {"AU", "{house}\n{unit}/{house_number} {road}\n{suburb}\n{city} {state} {postcode}\n{country}"},
+  {"GB", "{house}\n{unit}\n{house_number} {road}\n{suburb}\n{city}\n{postcode}\n{country}"},
+  {"IE", "{house}\n{unit}\n{house_number} {road}\n{suburb}\n{city}\n{state}\n{postcode}\n{country}"},
+  {"FR", "{house}\n{house_number} {road}\n{unit}\n{postcode} {city}\n{country}"},
+  {"DE", "{house}\n{road} {house_number}\n{unit}\n{postcode} {city}\n{country}"},
+  {"AT", "{house}\n{road} {house_number}\n{unit}\n{postcode} {city}\n{country}"},
+  {"CH", "{house}\n{road} {house_number}\n{unit}\n{postcode} {city}\n{country}"},
+  {"NL", "{house}\n{road} {house_number}\n{unit}\n{postcode} {city}\n{country}"},
+  {"IT", "{house}\n{road} {house_number}\n{unit}\n{postcode} {city} {state}\n{country}"},
+  {"ES", "{house}\n{road}, {house_number}\n{unit}\n{postcode} {city}\n{state}\n{country}"},
+  {"BR", "{house}\n{road}, {house_number}\n{unit}\n{suburb}\n{city} - {state}\n{postcode}\n{country}"},
+  {"RU", "{country}\n{postcode}\n{state}\n{city}\n{road}, {house_number}\n{unit}\n{house}"},
+  {"JP", "{country}\n{postcode}\n{state}{city}{suburb}{road}{house_number}\n{house} {unit}"},
+  {"CN", "{country}\n{postcode}\n{state}{city}{city_district}{road}{house_number}\n{house} {unit}"},
+  {"KR", "{country}\n{state} {city} {city_district} {road} {house_number}\n{house} {unit}\n{postcode}"}
+};
+
+static const std::map<std::string, address_template>& builtin_formats(){
+  static const std::map<std::string, address_template> formats = [](){
+    std::map<std::string, address_template> compiled;
+    std::string error;
+    for(size_t i = 0; i < sizeof(builtin_templates) / sizeof(builtin_templates[0]); i++){
+      compiled[builtin_templates[i][0]].compile(builtin_templates[i][1], error);
+    }
+    return compiled;
+  }();
+  return formats;
+}
+
+bool address_formats::add(const std::string& country, const std::string& source, std::string& error){
+  std::string key = country;
+  if(key != "default"){
+    for(size_t i = 0; i < key.size(); i++){
+      key[i] = toupper((unsigned char) key[i]);
+    }
+  }
+  return custom[key].compile(source, error);
+}
+
+const address_template& address_formats::lookup(const char* country) const {
+  const std::map<std::string, address_template>& builtin = builtin_formats();
+  char key[3] = {0, 0, 0};
+  if(country != NULL && strlen(country) == 2){
+    key[0] = toupper((unsigned char) country[0]);
+    key[1] = toupper((unsigned char) country[1]);
+    std::map<std::string, address_template>::const_iterator found = custom.find(key);
+    if(found != custom.end()){
+      return found->second;
+    }
+    found = builtin.find(key);
+    if(found != builtin.end()){
+      return found->second;
+    }
+  }
+  std::map<std::string, address_template>::const_iterator fallback = custom.find("default");
+  return fallback != custom.end() ? fallback->second : builtin.find("default")->second;
+}
@@ -0,0 +1,72 @@
+#include <map>
+#include <string>
+#include <vector>
+#include "core.h"
+
+#ifndef __POSTER_FORMATTER__
+#define __POSTER_FORMATTER__
+
+// An address's components, pointing into wherever they are held, indexed by
+// label. A component of size 0 is missing.
+struct component_view {
+  const char* data[PARSER_LABEL_COUNT];
+  size_t size[PARSER_LABEL_COUNT];
+  component_view();
+  void set(const parsed_address& parsed);
+};
+
+// A postal format, such as "{house_number} {road}\n{postcode} {city}",
+// compiled into lines of literal text and component slots. Components are
+// named as libpostal labels them, or as parse_addr's columns are.
+//
+// A line is left out if none of its components are present. Within a line,
+// text between two components is kept only if both sides of it have a
+// component present, so that missing components don't leave separators
+// behind; text at the start or end of a line is kept with the line.
+class address_template {
+
+private:
+
+  struct piece {
+    int label;
+    std::string text;
+  };
+
+  std::vector<std::vector<piece> > lines;
+
+public:
+
+  // Compiles source, returning false and setting error if it is malformed.
+  bool compile(const std::string& source, std::string& error);
+
+  // Renders components, joining lines with separator, into output if it
+  // isn't NULL. Returns the bytes rendered, so that it can be called once to
+  // size a buffer and again to fill it.
+  size_t render(const component_view& components, const std::string& separator, char* output) const;
+
+  // Renders components into output, sized to fit exactly.
+  void render(const component_view& components, const std::string& separator, poster_string& output) const;
+
+};
+
+// Templates by ISO 3166 country code: those given, then poster's own, then a
+// default for countries neither covers. poster's own are compiled once, when
+// they are first needed.
+class address_formats {
+
+private:
+
+  std::map<std::string, address_template> custom;
+
+public:
+
+  // Adds a template for country ("default" for the fallback), returning
+  // false and setting error if it doesn't compile.
+  bool add(const std::string& country, const std::string& source, std::string& error);
+
+  // The template for country, which may be NULL.
+  const address_template& lookup(const char* country) const;
+
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include "governor.h"
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+std::mutex resource_governor::mutex;
+size_t resource_governor::max_threads = SIZE_MAX;
+size_t resource_governor::max_memory = SIZE_MAX;
+bool resource_governor::obey_cgroup = false;
+size_t resource_governor::threads_in_use = 0;
+size_t resource_governor::memory_in_use = 0;
+
+// The lesser of two of the cgroup's limits, where 0 is none.
+static size_t tighter(size_t a, size_t b){
+  if(a == 0){
+    return b;
+  }
+  return (b == 0) ? a : std::min(a, b);
+}
+
+// What is left of a cap.
+static size_t left_under(size_t limit, size_t used, size_t wanted){
+  return used >= limit ? 0 : std::min(wanted, limit - used);
+}
+
+// The first line of a file, or "" if it can't be read.
+static std::string read_line(const std::string& path){
+  FILE* file = fopen(path.c_str(), "r");
+  if(file == NULL){
+    return "";
+  }
+  char line[256];
+  std::string output;
+  if(fgets(line, sizeof(line), file) != NULL){
+    output = line;
+    output.erase(output.find_last_not_of("\n") + 1);
+  }
+  fclose(file);
+  return output;
+}
+
+// Where the process's cgroup is in controller's hierarchy, or in the
+// unified (v2) hierarchy if controller is "", or "" if it isn't in one.
+static std::string cgroup_path(const std::string& controller){
+  FILE* file = fopen("/proc/self/cgroup", "r");
+  if(file == NULL){
+    return "";
+  }
+  char line[512];
+  std::string output;
+  while(fgets(line, sizeof(line), file) != NULL){
+    // Each line is "<id>:<controllers>:<path>".
+    std::string entry(line);
+    size_t first = entry.find(':'), second = entry.find(':', first + 1);
+    if(first == std::string::npos || second == std::string::npos){
+      continue;
+    }
+    std::string controllers = "," + entry.substr(first + 1, second - first - 1) + ",";
+    if(controller.empty() ? controllers == ",," : controllers.find("," + controller + ",") != std::string::npos){
+      output = entry.substr(second + 1);
+      output.erase(output.find_last_not_of("\n") + 1);
+      break;
+    }
+  }
+  fclose(file);
+  return output;
+}
+
+// The tightest of the limits that read finds in the directories of the
+// process's cgroup and of those it is nested in, under base (read returns 0
+// for none, as this does).
+static size_t cgroup_limit(const std::string& base, const std::string& controller,
+                           size_t (*read)(const std::string&)){
+  std::string path = cgroup_path(controller);
+  size_t limit = 0;
+  while(true){
+    limit = tighter(limit, read(base + path));
+    if(path.empty() || path == "/"){
+      break;
+    }
+    path.erase(path.find_last_of('/'));
+  }
+  return limit;
+}
+
+// cgroup v2's cpu.max is "<quota> <period>", or "max <period>".
+static size_t read_cpu_max(const std::string& directory){
+  double quota, period;
+  if(sscanf(read_line(directory + "/cpu.max").c_str(), "%lf %lf", &quota, &period) != 2 || period <= 0){
+    return 0;
+  }
+  return (size_t) std::max(1.0, std::ceil(quota / period));
+}
+
+// cgroup v1's quota is -1 when there isn't one.
+static size_t read_cfs_quota(const std::string& directory){
+  double quota = atof(read_line(directory + "/cpu.cfs_quota_us").c_str());
+  double period = atof(read_line(directory + "/cpu.cfs_period_us").c_str());
+  if(quota <= 0 || period <= 0){
+    return 0;
+  }
+  return (size_t) std::max(1.0, std::ceil(quota / period));
+}
+
+// cgroup v2's memory.max is a number of bytes, or "max".
+static size_t read_memory_max(const std::string& directory){
+  double bytes;
+  if(sscanf(read_line(directory + "/memory.max").c_str(), "%lf", &bytes) != 1 || bytes <= 0){
+    return 0;
+  }
+  return (size_t) bytes;
+}
+
+// cgroup v1's limit is a huge number when there isn't one.
+static size_t read_memory_limit(const std::string& directory){
+  double bytes = atof(read_line(directory + "/memory.limit_in_bytes").c_str());
+  return (bytes > 0 && bytes < 1e18) ? (size_t) bytes : 0;
+}
+
+size_t resource_governor::cgroup_cpus(){
+  size_t cpus = tighter(cgroup_limit("/sys/fs/cgroup", "", read_cpu_max),
+                        cgroup_limit("/sys/fs/cgroup/cpu", "cpu", read_cfs_quota));
+#ifdef __linux__
+  cpu_set_t affinity;
+  if(sched_getaffinity(0, sizeof(affinity), &affinity) == 0){
+    size_t allowed = CPU_COUNT(&affinity);
+    if(allowed > 0 && allowed < std::thread::hardware_concurrency()){
+      cpus = tighter(cpus, allowed);
+    }
+  }
+#endif
+  return cpus;
+}
+
+size_t resource_governor::cgroup_memory(){
+  return tighter(cgroup_limit("/sys/fs/cgroup", "", read_memory_max),
+                 cgroup_limit("/sys/fs/cgroup/memory", "memory", read_memory_limit));
+}
+
+// The cgroup's limits are read once, when they are asked to be obeyed,
+// rather than on every grant.
+void resource_governor::set_limits(size_t threads, size_t memory, bool cgroup){
+  if(cgroup){
+    size_t cpus = cgroup_cpus();
+    size_t bytes = cgroup_memory();
+    if(cpus > 0){
+      threads = std::min(threads, cpus);
+    }
+    if(bytes > 0){
+      memory = std::min(memory, (size_t) (bytes * POSTER_CGROUP_MEMORY_SHARE));
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  max_threads = threads;
+  max_memory = memory;
+  obey_cgroup = cgroup;
+}
+
+size_t resource_governor::thread_limit(){
+  std::lock_guard<std::mutex> lock(mutex);
+  return max_threads;
+}
+
+size_t resource_governor::memory_limit(){
+  std::lock_guard<std::mutex> lock(mutex);
+  return max_memory;
+}
+
+bool resource_governor::obeys_cgroup(){
+  std::lock_guard<std::mutex> lock(mutex);
+  return obey_cgroup;
+}
+
+size_t resource_governor::threads_used(){
+  std::lock_guard<std::mutex> lock(mutex);
+  return threads_in_use;
+}
+
+size_t resource_governor::memory_used(){
+  std::lock_guard<std::mutex> lock(mutex);
+  return memory_in_use;
+}
+
+size_t resource_governor::acquire_threads(size_t wanted){
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t granted = left_under(max_threads, threads_in_use, wanted);
+  threads_in_use += granted;
+  return granted;
+}
+
+size_t resource_governor::reserve(size_t wanted){
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t granted = left_under(max_memory, memory_in_use, wanted);
+  memory_in_use += granted;
+  return granted;
+}
+
+bool resource_governor::reserve_all(size_t bytes){
+  std::lock_guard<std::mutex> lock(mutex);
+  if(left_under(max_memory, memory_in_use, bytes) < bytes){
+    return false;
+  }
+  memory_in_use += bytes;
+  return true;
+}
+
+void resource_governor::release_threads(size_t threads){
+  std::lock_guard<std::mutex> lock(mutex);
+  threads_in_use -= std::min(threads, threads_in_use);
+}
+
+void resource_governor::release(size_t bytes){
+  std::lock_guard<std::mutex> lock(mutex);
+  memory_in_use -= std::min(bytes, memory_in_use);
+}
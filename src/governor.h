@@ -0,0 +1,113 @@
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#ifndef __POSTER_GOVERNOR__
+#define __POSTER_GOVERNOR__
+
+// The share of a cgroup's memory limit that poster's own caches, buffers and
+// spill may take, leaving the rest to R and libpostal's models.
+#define POSTER_CGROUP_MEMORY_SHARE 0.5
+
+// Process-wide caps on what poster's entry points take between them, so that
+// concurrent calls and services can't oversubscribe the machine: worker
+// threads, and native memory for caches, pooled buffers and the rows a store
+// holds before spilling. Each entry point is granted what is left under a cap,
+// up to what it wants, and gives it back when done. Asked to, the governor
+// also keeps to the CPU and memory limits of the process's cgroup.
+class resource_governor {
+
+private:
+
+  static std::mutex mutex;
+  static size_t max_threads;
+  static size_t max_memory;
+  static bool obey_cgroup;
+  static size_t threads_in_use;
+  static size_t memory_in_use;
+
+public:
+
+  // Sets the caps, SIZE_MAX meaning none, tightened to the cgroup's as they
+  // are now if cgroup is true.
+  static void set_limits(size_t threads, size_t memory, bool cgroup);
+
+  // The caps in force: SIZE_MAX means none.
+  static size_t thread_limit();
+  static size_t memory_limit();
+
+  static bool obeys_cgroup();
+
+  static size_t threads_used();
+  static size_t memory_used();
+
+  // Grants up to wanted threads or bytes, as many as are left.
+  static size_t acquire_threads(size_t wanted);
+  static size_t reserve(size_t wanted);
+
+  // Grants exactly bytes, or nothing.
+  static bool reserve_all(size_t bytes);
+
+  static void release_threads(size_t threads);
+  static void release(size_t bytes);
+
+  // The CPUs and memory the process's cgroup allows it (CPUs rounded up, and
+  // no more than its affinity mask allows), or 0 if it sets no limit.
+  static size_t cgroup_cpus();
+  static size_t cgroup_memory();
+
+};
+
+// Memory granted for the lifetime of a scope.
+class memory_grant {
+
+private:
+
+  size_t granted;
+
+public:
+
+  memory_grant(size_t wanted) : granted(resource_governor::reserve(wanted)) {}
+
+  ~memory_grant(){
+    resource_governor::release(granted);
+  }
+
+  // Grows the grant by exactly bytes, or leaves it as it was.
+  bool extend(size_t bytes){
+    if(!resource_governor::reserve_all(bytes)){
+      return false;
+    }
+    granted += bytes;
+    return true;
+  }
+
+  size_t bytes() const {
+    return granted;
+  }
+
+};
+
+// Threads granted for the lifetime of a scope.
+class thread_grant {
+
+private:
+
+  size_t granted;
+
+public:
+
+  thread_grant(size_t wanted) : granted(resource_governor::acquire_threads(wanted)) {}
+
+  ~thread_grant(){
+    resource_governor::release_threads(granted);
+  }
+
+  size_t threads() const {
+    return granted;
+  }
+
+};
+
+#endif
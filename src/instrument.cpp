@@ -0,0 +1,200 @@
+#include <cstdio>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "instrument.h"
+
+const char* stage_names[STAGE_COUNT] = {
+  "read",
+  "expand",
+  "parse",
+  "convert",
+  "write"
+};
+
+std::atomic<bool> memory_accounting::enabled(false);
+thread_local poster_stage memory_accounting::stage = STAGE_READ;
+thread_local call_counts* memory_accounting::sink = NULL;
+call_counts memory_accounting::last_call;
+
+// Current resident set size in bytes, from /proc/self/statm.
+long memory_accounting::read_rss(long pid){
+  long pages = 0;
+  char path[64];
+  if(pid > 0){
+    snprintf(path, sizeof(path), "/proc/%ld/statm", pid);
+  } else {
+    snprintf(path, sizeof(path), "/proc/self/statm");
+  }
+  FILE* statm = fopen(path, "r");
+  if(statm == NULL){
+    return 0;
+  }
+  if(fscanf(statm, "%*s %ld", &pages) != 1){
+    pages = 0;
+  }
+  fclose(statm);
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+call_accounting::call_accounting() : previous(memory_accounting::sink) {
+  call_counts& counts = memory_accounting::last_call;
+  if(previous == &counts){
+    return;
+  }
+  if(memory_accounting::enabled){
+    for(unsigned int i = 0; i < STAGE_COUNT; i++){
+      counts.allocations[i] = 0;
+      counts.bytes[i] = 0;
+    }
+    counts.libpostal_responses = 0;
+    counts.libpostal_bytes = 0;
+    counts.r_vector_bytes = 0;
+    counts.rss_start = memory_accounting::read_rss();
+    counts.rss_peak = counts.rss_start.load();
+  }
+  memory_accounting::sink = &counts;
+}
+
+// The resident set size is the whole process's, so while other poster work
+// runs alongside a call its peak includes that work's memory too.
+void memory_accounting::sample_rss(){
+  call_counts* counts = sink;
+  if(counts == NULL || !enabled){
+    return;
+  }
+  long current = read_rss();
+  long peak = counts->rss_peak.load();
+  while(current > peak && !counts->rss_peak.compare_exchange_weak(peak, current)){}
+}
+
+// The process-wide resident high-water mark, in bytes.
+long memory_accounting::rss_high_water(){
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) != 0){
+    return 0;
+  }
+  return usage.ru_maxrss * 1024L;
+}
+
+std::atomic<bool> tracing::enabled(false);
+std::atomic<uint64_t> tracing::generation(0);
+size_t tracing::capacity = 0;
+
+static std::mutex trace_lock;
+static std::vector<trace_ring*> trace_rings;
+static std::chrono::steady_clock::time_point trace_epoch;
+
+// trace_lock is held across a fork, so that a model worker never inherits it
+// held by a thread it doesn't have, and hangs registering its own.
+static void lock_traces(){ trace_lock.lock(); }
+static void unlock_traces(){ trace_lock.unlock(); }
+static int trace_fork_handlers = pthread_atfork(lock_traces, unlock_traces, unlock_traces);
+
+// The calling thread's ring, given up for another thread to use once it exits.
+struct ring_holder {
+  trace_ring* ring;
+  uint64_t generation;
+  ring_holder() : ring(NULL), generation(0) {}
+  ~ring_holder(){
+    if(ring != NULL){
+      std::lock_guard<std::mutex> guard(trace_lock);
+      ring->in_use = false;
+    }
+  }
+};
+
+static thread_local ring_holder local;
+
+trace_ring* tracing::register_thread(){
+  std::lock_guard<std::mutex> guard(trace_lock);
+  trace_ring* ring = local.ring;
+  if(ring == NULL){
+    for(unsigned int i = 0; i < trace_rings.size() && ring == NULL; i++){
+      if(!trace_rings[i]->in_use){
+        ring = trace_rings[i];
+      }
+    }
+    if(ring == NULL){
+      ring = new trace_ring(trace_rings.size() + 1);
+      trace_rings.push_back(ring);
+    }
+    ring->in_use = true;
+    local.ring = ring;
+  }
+  ring->events.assign(capacity, trace_event());
+  ring->head = 0;
+  ring->generation = generation;
+  local.generation = ring->generation;
+  return ring;
+}
+
+void tracing::start(size_t capacity){
+  std::lock_guard<std::mutex> guard(trace_lock);
+  tracing::capacity = capacity;
+  generation++;
+  trace_epoch = std::chrono::steady_clock::now();
+  enabled = true;
+}
+
+void tracing::record(const char* name, char phase, int64_t chunk){
+  trace_ring* ring = local.ring;
+  if(ring == NULL || local.generation != generation.load()){
+    ring = register_thread();
+  }
+  // Marked as writing before checking that the trace is still going, so
+  // that stop() either sees the mark and waits or this sees it stopped.
+  ring->writing.store(true);
+  if(!enabled.load()){
+    ring->writing.store(false, std::memory_order_release);
+    return;
+  }
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  trace_event& event = ring->events[head % ring->events.size()];
+  event.name = name;
+  event.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+  event.chunk = chunk;
+  event.phase = phase;
+  ring->head.store(head + 1, std::memory_order_release);
+  ring->writing.store(false, std::memory_order_release);
+}
+
+// Stop tracing and write what was recorded to path; returns the number of events.
+size_t tracing::stop(const std::string& path){
+  enabled = false;
+  std::lock_guard<std::mutex> guard(trace_lock);
+  for(unsigned int r = 0; r < trace_rings.size(); r++){
+    while(trace_rings[r]->writing.load(std::memory_order_acquire)){
+      std::this_thread::yield();
+    }
+  }
+  FILE* output = fopen(path.c_str(), "w");
+  if(output == NULL){
+    throw std::runtime_error("Could not open " + path + " to write the trace");
+  }
+  size_t written = 0;
+  long pid = (long) getpid();
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", output);
+  for(unsigned int r = 0; r < trace_rings.size(); r++){
+    trace_ring* ring = trace_rings[r];
+    if(ring->generation != generation){
+      continue;
+    }
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t count = head < ring->events.size() ? head : ring->events.size();
+    for(uint64_t i = head - count; i < head; i++){
+      const trace_event& event = ring->events[i % ring->events.size()];
+      fprintf(output, "%s\n{\"name\":\"%s\",\"cat\":\"poster\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%ld,\"tid\":%llu,\"args\":{\"chunk\":%lld}}",
+              written == 0 ? "" : ",", event.name, event.phase, event.timestamp / 1000.0, pid,
+              (unsigned long long) ring->tid, (long long) event.chunk);
+      written++;
+    }
+  }
+  fputs("\n]}\n", output);
+  fclose(output);
+  return written;
+}
@@ -0,0 +1,230 @@
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <new>
+
+#ifndef __POSTER_INSTRUMENT__
+#define __POSTER_INSTRUMENT__
+
+// The stages a call passes through, used to attribute its cost.
+enum poster_stage {
+  STAGE_READ,
+  STAGE_EXPAND,
+  STAGE_PARSE,
+  STAGE_CONVERT,
+  STAGE_WRITE,
+  STAGE_COUNT
+};
+
+extern const char* stage_names[STAGE_COUNT];
+
+// What one call counted. The threads working on the call may add to it at
+// once, so the counts are atomic.
+struct call_counts {
+  std::atomic<size_t> allocations[STAGE_COUNT];
+  std::atomic<size_t> bytes[STAGE_COUNT];
+  std::atomic<size_t> libpostal_responses;
+  std::atomic<size_t> libpostal_bytes;
+  std::atomic<size_t> r_vector_bytes;
+  std::atomic<long> rss_start;
+  std::atomic<long> rss_peak;
+};
+
+// Per-call memory accounting. Nothing is counted unless it has been switched
+// on with memory_accounting(TRUE), and then only on threads working on a
+// call, each of which counts into its call's counts through sink. Threads
+// outside any call, such as the service's workers and the metrics
+// exporter, leave sink NULL, so their work never mixes into a call's
+// report. The report covers the most recent call.
+class memory_accounting {
+
+public:
+
+  // The resident set size of process pid, or of this process if it's 0.
+  static long read_rss(long pid = 0);
+
+  static std::atomic<bool> enabled;
+  static thread_local poster_stage stage;
+  static thread_local call_counts* sink;
+  static call_counts last_call;
+
+  static void sample_rss();
+
+  static long rss_high_water();
+
+  static inline void count_allocation(size_t n){
+    call_counts* counts = sink;
+    if(counts != NULL && enabled.load(std::memory_order_relaxed)){
+      counts->allocations[stage].fetch_add(1, std::memory_order_relaxed);
+      counts->bytes[stage].fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+
+  static inline void count_libpostal(size_t n){
+    call_counts* counts = sink;
+    if(counts != NULL && enabled.load(std::memory_order_relaxed)){
+      counts->libpostal_responses.fetch_add(1, std::memory_order_relaxed);
+      counts->libpostal_bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+
+  static inline void count_r_vector(size_t n){
+    call_counts* counts = sink;
+    if(counts != NULL && enabled.load(std::memory_order_relaxed)){
+      counts->r_vector_bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+  }
+
+};
+
+// Makes its thread count into last_call for its lifetime, first clearing the
+// previous call's counts. A call made within another is counted as part of
+// it. Threads a call starts to share its work should take the caller's sink.
+class call_accounting {
+
+private:
+
+  call_counts* previous;
+
+public:
+
+  call_accounting();
+
+  ~call_accounting(){
+    memory_accounting::sink = previous;
+  }
+
+};
+
+// Attributes everything allocated in its lifetime to a stage.
+class stage_scope {
+
+private:
+
+  poster_stage previous;
+
+public:
+
+  stage_scope(poster_stage stage) : previous(memory_accounting::stage) {
+    memory_accounting::stage = stage;
+  }
+
+  ~stage_scope(){
+    memory_accounting::stage = previous;
+  }
+
+};
+
+// An allocator for poster-owned buffers that reports to memory_accounting.
+template <typename T>
+struct counting_allocator {
+
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind {
+    typedef counting_allocator<U> other;
+  };
+
+  counting_allocator() {}
+
+  template <typename U>
+  counting_allocator(const counting_allocator<U>&) {}
+
+  T* allocate(size_t n){
+    memory_accounting::count_allocation(n * sizeof(T));
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t){
+    ::operator delete(p);
+  }
+
+};
+
+template <typename T, typename U>
+bool operator==(const counting_allocator<T>&, const counting_allocator<U>&){
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const counting_allocator<T>&, const counting_allocator<U>&){
+  return false;
+}
+
+typedef std::basic_string<char, std::char_traits<char>, counting_allocator<char> > poster_string;
+
+// A begin or end event in a trace.
+struct trace_event {
+  const char* name;
+  uint64_t timestamp;
+  int64_t chunk;
+  char phase;
+};
+
+// One thread's events. Only its own thread writes to it, so recording an
+// event needs no lock; the oldest events are overwritten once it is full.
+// Rings are never freed: a thread resets its own ring, under the tracing
+// lock, the first time it records in a new trace, and hands it on to another
+// thread when it exits. writing is set while an event is being written.
+struct trace_ring {
+  std::vector<trace_event> events;
+  std::atomic<uint64_t> head;
+  std::atomic<bool> writing;
+  uint64_t generation;
+  uint64_t tid;
+  bool in_use;
+  trace_ring(uint64_t tid) : head(0), writing(false), generation(0), tid(tid), in_use(true) {}
+};
+
+// Opt-in tracing of chunks and stages, written out as Chrome trace-event JSON.
+// Tracing can be started and stopped while other threads, such as the
+// service's workers, are recording: starting a trace only moves on its
+// generation, and stopping waits for events being written to finish.
+class tracing {
+
+private:
+
+  static std::atomic<uint64_t> generation;
+  static size_t capacity;
+  static trace_ring* register_thread();
+
+public:
+
+  static std::atomic<bool> enabled;
+
+  static void start(size_t capacity);
+
+  static size_t stop(const std::string& path);
+
+  static void record(const char* name, char phase, int64_t chunk);
+
+};
+
+// Records a begin event on construction and the matching end on destruction.
+class trace_scope {
+
+private:
+
+  const char* name;
+  int64_t chunk;
+
+public:
+
+  trace_scope(const char* name, int64_t chunk) : name(name), chunk(chunk) {
+    if(tracing::enabled.load(std::memory_order_relaxed)){
+      tracing::record(name, 'B', chunk);
+    }
+  }
+
+  ~trace_scope(){
+    if(tracing::enabled.load(std::memory_order_relaxed)){
+      tracing::record(name, 'E', chunk);
+    }
+  }
+
+};
+
+#endif
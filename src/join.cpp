@@ -0,0 +1,254 @@
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include "instrument.h"
+#include "join.h"
+
+// MurmurHash3's finaliser, which spreads every input bit over every output bit.
+static inline uint64_t fmix64(uint64_t x){
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static inline uint64_t rotl64(uint64_t x, int bits){
+  return (x << bits) | (x >> (64 - bits));
+}
+
+// Two independent 64-bit lanes, fed a word at a time, with the tail and the
+// length folded into the last.
+void join_hash(const char* data, size_t size, uint64_t& hi, uint64_t& lo){
+  uint64_t a = 0x9e3779b97f4a7c15ULL, b = 0x243f6a8885a308d3ULL;
+  size_t i = 0;
+  for(; i + 8 <= size; i += 8){
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    a = (a ^ fmix64(word)) * 0x9e3779b97f4a7c15ULL;
+    b = rotl64(b ^ fmix64(word ^ 0x452821e638d01377ULL), 31) * 0xc2b2ae3d27d4eb4fULL;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, data + i, size - i);
+  tail ^= (uint64_t) size << 56;
+  a = (a ^ fmix64(tail)) * 0x9e3779b97f4a7c15ULL;
+  b = rotl64(b ^ fmix64(tail ^ 0x452821e638d01377ULL), 31) * 0xc2b2ae3d27d4eb4fULL;
+  hi = fmix64(a ^ size);
+  lo = fmix64(b + a);
+}
+
+// An exception escaping a thread's function would terminate the process, so
+// each thread's is caught and kept for the caller. Each thread counts its
+// memory into the caller's call.
+void run_parallel(unsigned int threads, const std::function<void(unsigned int)>& work){
+  std::vector<std::exception_ptr> thrown(std::max(1u, threads));
+  call_counts* sink = memory_accounting::sink;
+  auto guarded = [&](unsigned int t){
+    memory_accounting::sink = sink;
+    try {
+      work(t);
+    } catch(...){
+      thrown[t] = std::current_exception();
+    }
+  };
+  std::vector<std::thread> workers;
+  try {
+    for(unsigned int t = 1; t < threads; t++){
+      workers.push_back(std::thread(guarded, t));
+    }
+  } catch(...){
+    thrown[0] = std::current_exception();
+  }
+  if(!thrown[0]){
+    guarded(0);
+  }
+  for(unsigned int t = 0; t < workers.size(); t++){
+    workers[t].join();
+  }
+  for(unsigned int t = 0; t < thrown.size(); t++){
+    if(thrown[t]){
+      std::rethrow_exception(thrown[t]);
+    }
+  }
+}
+
+static inline unsigned int partition_of(const join_key& key, unsigned int bits){
+  return key.hi >> (64 - bits);
+}
+
+// The partition bits for joining sides of up to rows keys.
+static unsigned int partition_bits(size_t rows){
+  unsigned int bits = POSTER_JOIN_MIN_PARTITION_BITS;
+  while(bits < POSTER_JOIN_MAX_PARTITION_BITS && (rows >> bits) > POSTER_JOIN_PARTITION_KEYS){
+    bits++;
+  }
+  return bits;
+}
+
+// Reorders keys by their partition of 1 << bits, stably, setting where each
+// partition starts (and, at the end of offsets, where the last ends). Each
+// thread counts and then scatters a slice of its own.
+static void partition(std::vector<join_key>& keys, unsigned int bits, unsigned int threads,
+                      std::vector<size_t>& offsets){
+  size_t rows = keys.size();
+  unsigned int partitions = 1u << bits;
+  std::vector<std::vector<size_t> > starts(threads, std::vector<size_t>(partitions, 0));
+  run_parallel(threads, [&](unsigned int t){
+    for(size_t i = rows * t / threads; i < rows * (t + 1) / threads; i++){
+      starts[t][partition_of(keys[i], bits)]++;
+    }
+  });
+  offsets.assign(partitions + 1, 0);
+  size_t running = 0;
+  for(unsigned int p = 0; p < partitions; p++){
+    offsets[p] = running;
+    for(unsigned int t = 0; t < threads; t++){
+      size_t count = starts[t][p];
+      starts[t][p] = running;
+      running += count;
+    }
+  }
+  offsets[partitions] = running;
+  std::vector<join_key> scattered(rows);
+  run_parallel(threads, [&](unsigned int t){
+    for(size_t i = rows * t / threads; i < rows * (t + 1) / threads; i++){
+      scattered[starts[t][partition_of(keys[i], bits)]++] = keys[i];
+    }
+  });
+  keys.swap(scattered);
+}
+
+// A hash table over one partition's keys on its build side. Each slot holds
+// the first of the keys that are equal, and the rest are chained from it in
+// the order they were built from.
+class partition_table {
+
+private:
+
+  std::vector<int64_t> slots;
+  std::vector<int64_t> chained;
+  const join_key* keys;
+  size_t mask;
+
+public:
+
+  void build(const join_key* build, size_t rows){
+    keys = build;
+    size_t capacity = 16;
+    while(capacity < rows * 2){
+      capacity <<= 1;
+    }
+    mask = capacity - 1;
+    slots.assign(capacity, -1);
+    chained.assign(rows, -1);
+    // Keys are added last first, so that each chain runs in build order.
+    for(size_t i = rows; i-- > 0; ){
+      size_t slot = keys[i].lo & mask;
+      while(slots[slot] >= 0 && (keys[slots[slot]].hi != keys[i].hi || keys[slots[slot]].lo != keys[i].lo)){
+        slot = (slot + 1) & mask;
+      }
+      chained[i] = slots[slot];
+      slots[slot] = i;
+    }
+  }
+
+  // The first key equal to key, or -1, with the rest from next().
+  int64_t find(const join_key& key) const {
+    size_t slot = key.lo & mask;
+    while(slots[slot] >= 0){
+      const join_key& found = keys[slots[slot]];
+      if(found.hi == key.hi && found.lo == key.lo){
+        return slots[slot];
+      }
+      slot = (slot + 1) & mask;
+    }
+    return -1;
+  }
+
+  int64_t next(int64_t entry) const {
+    return chained[entry];
+  }
+
+};
+
+size_t radix_join_bytes(size_t x_rows, size_t y_rows){
+  return std::max(x_rows, y_rows) * sizeof(join_key) + (x_rows + 1) * sizeof(uint64_t);
+}
+
+// Joins partition p of x and y with table, calling found(x_row, y_row) for
+// each pair. Partitioning keeps keys in row order within a partition, and
+// chains run in build order, so an x row's pairs are found in y row order.
+template <typename F>
+static void join_partition(const std::vector<join_key>& x, const std::vector<size_t>& x_offsets,
+                           const std::vector<join_key>& y, const std::vector<size_t>& y_offsets,
+                           unsigned int p, partition_table& table, F found){
+  const join_key* x_keys = x.data() + x_offsets[p];
+  const join_key* y_keys = y.data() + y_offsets[p];
+  size_t x_rows = x_offsets[p + 1] - x_offsets[p];
+  size_t y_rows = y_offsets[p + 1] - y_offsets[p];
+  if(x_rows == 0 || y_rows == 0){
+    return;
+  }
+  bool build_x = x_rows <= y_rows;
+  const join_key* build = build_x ? x_keys : y_keys;
+  const join_key* probe = build_x ? y_keys : x_keys;
+  size_t probe_rows = build_x ? y_rows : x_rows;
+  table.build(build, build_x ? x_rows : y_rows);
+  for(size_t i = 0; i < probe_rows; i++){
+    for(int64_t entry = table.find(probe[i]); entry >= 0; entry = table.next(entry)){
+      found(build_x ? build[entry].row : probe[i].row, build_x ? probe[i].row : build[entry].row);
+    }
+  }
+}
+
+size_t radix_join(std::vector<join_key>& x, std::vector<join_key>& y, unsigned int threads,
+                  memory_grant& output, std::vector<uint64_t>& pairs){
+
+  threads = std::max(1u, threads);
+  size_t x_rows = x.empty() ? 0 : x.back().row + 1;
+  unsigned int bits = partition_bits(std::max(x.size(), y.size()));
+  unsigned int partitions = 1u << bits;
+  std::vector<size_t> x_offsets, y_offsets;
+  partition(x, bits, threads, x_offsets);
+  partition(y, bits, threads, y_offsets);
+
+  // Count each x row's pairs. Every x row is in one partition, so only one
+  // thread ever counts it.
+  std::vector<uint64_t> starts(x_rows + 1, 0);
+  std::atomic<unsigned int> next_partition(0);
+  run_parallel(threads, [&](unsigned int){
+    partition_table table;
+    unsigned int p;
+    while((p = next_partition++) < partitions){
+      join_partition(x, x_offsets, y, y_offsets, p, table, [&starts](uint64_t x_row, uint64_t){
+        starts[x_row + 1]++;
+      });
+    }
+  });
+  for(size_t row = 0; row < x_rows; row++){
+    starts[row + 1] += starts[row];
+  }
+  size_t total = starts[x_rows];
+  pairs.clear();
+  if(!output.extend(total * sizeof(uint64_t))){
+    return total;
+  }
+
+  // Then write each x row's pairs from where its count says they start,
+  // which leaves them in order.
+  pairs.resize(total);
+  next_partition = 0;
+  run_parallel(threads, [&](unsigned int){
+    partition_table table;
+    unsigned int p;
+    while((p = next_partition++) < partitions){
+      join_partition(x, x_offsets, y, y_offsets, p, table, [&starts, &pairs](uint64_t x_row, uint64_t y_row){
+        pairs[starts[x_row]++] = (x_row << 32) | y_row;
+      });
+    }
+  });
+  return total;
+}
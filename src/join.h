@@ -0,0 +1,54 @@
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "governor.h"
+
+#ifndef __POSTER_JOIN__
+#define __POSTER_JOIN__
+
+// Keys are radix-partitioned on the top bits of their hash, as many as it
+// takes for a partition of the larger side to hold about
+// POSTER_JOIN_PARTITION_KEYS keys, so that its hash table (about 40 bytes a
+// key) stays in cache; but never fewer bits than make enough partitions to
+// share out between threads, nor more than keep the counts of each thread's
+// partitions small.
+#define POSTER_JOIN_PARTITION_KEYS 16384
+#define POSTER_JOIN_MIN_PARTITION_BITS 8
+#define POSTER_JOIN_MAX_PARTITION_BITS 16
+
+// A row's key, as a 128-bit hash of its canonical text. Rows are joined on
+// equal hashes; at 128 bits, two different keys colliding among even 10^8
+// rows a side is far less likely than a hardware error.
+struct join_key {
+  uint64_t hi;
+  uint64_t lo;
+  uint32_t row;
+};
+
+// Hashes size bytes at data into hi and lo.
+void join_hash(const char* data, size_t size, uint64_t& hi, uint64_t& lo);
+
+// Runs work(0) to work(threads - 1), on threads - 1 new threads and this one.
+// Once all have finished, the first exception any of them threw is rethrown
+// on this thread.
+void run_parallel(unsigned int threads, const std::function<void(unsigned int)>& work);
+
+// Finds every pair of an x key and a y key that are equal, returned as the
+// x row shifted up 32 bits and or'd with the y row, ordered by x row and then
+// y row. Keys must be in row order. Both sides are radix-partitioned (leaving
+// x and y in partition order), and each partition is joined by building a
+// hash table on its smaller side and probing it with the larger, threads
+// partitions at a time: once to count each x row's pairs, and again to write
+// them where those counts say its pairs go, so that they come out in order
+// without being sorted. Returns how many pairs there are, which are only
+// written if output could be extended to hold them.
+size_t radix_join(std::vector<join_key>& x, std::vector<join_key>& y, unsigned int threads,
+                  memory_grant& output, std::vector<uint64_t>& pairs);
+
+// The bytes radix_join needs beyond its inputs and output, for up to x_rows
+// and y_rows keys: a copy of the larger side to partition into, and a count
+// of each x row's pairs.
+size_t radix_join_bytes(size_t x_rows, size_t y_rows);
+
+#endif
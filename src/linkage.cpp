@@ -0,0 +1,147 @@
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include "join.h"
+#include "linkage.h"
+
+// Keys are partitioned on their first two bytes: addresses mostly start with
+// a digit, so the first alone leaves a handful of partitions to share out
+// between threads.
+#define POSTER_SORT_PARTITION_BITS 16
+#define POSTER_SORT_PARTITIONS (1 << POSTER_SORT_PARTITION_BITS)
+
+// A row to sort, with its key's first eight bytes in an order that compares
+// as they do.
+struct sort_entry {
+  uint64_t prefix;
+  uint32_t row;
+};
+
+static inline uint64_t key_prefix(const char* data, size_t size){
+  uint64_t prefix = 0;
+  for(size_t i = 0; i < 8; i++){
+    prefix = (prefix << 8) | (i < size ? (unsigned char) data[i] : 0);
+  }
+  return prefix;
+}
+
+static inline size_t partition_of(const sort_entry& entry){
+  return entry.prefix >> (64 - POSTER_SORT_PARTITION_BITS);
+}
+
+size_t sort_keys_bytes(size_t rows){
+  return 2 * rows * sizeof(sort_entry) + 2 * (POSTER_SORT_PARTITIONS + 1) * sizeof(size_t);
+}
+
+void sort_keys(const key_column& keys, unsigned int threads, std::vector<uint32_t>& order){
+
+  threads = std::max(1u, threads);
+  std::vector<sort_entry> entries;
+  for(size_t row = 0; row < keys.rows(); row++){
+    if(keys.size(row) > 0){
+      sort_entry entry;
+      entry.prefix = key_prefix(keys.data(row), keys.size(row));
+      entry.row = row;
+      entries.push_back(entry);
+    }
+  }
+
+  // Partition on the first two bytes, counting and then scattering.
+  std::vector<size_t> starts(POSTER_SORT_PARTITIONS + 1, 0);
+  for(size_t i = 0; i < entries.size(); i++){
+    starts[partition_of(entries[i]) + 1]++;
+  }
+  for(unsigned int b = 0; b < POSTER_SORT_PARTITIONS; b++){
+    starts[b + 1] += starts[b];
+  }
+  std::vector<sort_entry> partitioned(entries.size());
+  std::vector<size_t> next(starts.begin(), starts.end() - 1);
+  for(size_t i = 0; i < entries.size(); i++){
+    partitioned[next[partition_of(entries[i])]++] = entries[i];
+  }
+  std::vector<sort_entry>().swap(entries);
+  std::vector<size_t>().swap(next);
+
+  // Then sort each partition on the rest of the prefix, which only ever
+  // compares past the first eight bytes of keys that share them.
+  std::atomic<unsigned int> next_bucket(0);
+  run_parallel(threads, [&](unsigned int){
+    unsigned int b;
+    while((b = next_bucket++) < POSTER_SORT_PARTITIONS){
+      if(starts[b + 1] - starts[b] < 2){
+        continue;
+      }
+      std::sort(partitioned.begin() + starts[b], partitioned.begin() + starts[b + 1],
+                [&keys](const sort_entry& a, const sort_entry& b){
+        if(a.prefix != b.prefix){
+          return a.prefix < b.prefix;
+        }
+        size_t a_size = keys.size(a.row), b_size = keys.size(b.row);
+        if(a_size > 8 || b_size > 8){
+          size_t a_rest = a_size > 8 ? a_size - 8 : 0, b_rest = b_size > 8 ? b_size - 8 : 0;
+          int compared = memcmp(keys.data(a.row) + 8, keys.data(b.row) + 8, std::min(a_rest, b_rest));
+          if(compared != 0){
+            return compared < 0;
+          }
+          if(a_rest != b_rest){
+            return a_rest < b_rest;
+          }
+        }
+        return a.row < b.row;
+      });
+    }
+  });
+
+  order.resize(partitioned.size());
+  for(size_t i = 0; i < partitioned.size(); i++){
+    order[i] = partitioned[i].row;
+  }
+}
+
+void sorted_neighbourhood::start_pass(const key_column& keys, unsigned int threads){
+  sort_keys(keys, threads, order);
+  ranks.push_back(std::vector<uint32_t>(rows, UINT32_MAX));
+  std::vector<uint32_t>& rank = ranks.back();
+  for(size_t r = 0; r < order.size(); r++){
+    rank[order[r]] = r;
+  }
+  position = 0;
+  offset = 1;
+}
+
+bool sorted_neighbourhood::seen_before(uint32_t a, uint32_t b) const {
+  for(size_t pass = 0; pass + 1 < ranks.size(); pass++){
+    uint32_t a_rank = ranks[pass][a], b_rank = ranks[pass][b];
+    if(a_rank != UINT32_MAX && b_rank != UINT32_MAX &&
+       (a_rank > b_rank ? a_rank - b_rank : b_rank - a_rank) < window){
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t sorted_neighbourhood::next_pairs(size_t most, std::vector<uint32_t>& first, std::vector<uint32_t>& second){
+  size_t found = 0;
+  bool across = split < rows;
+  while(found < most && position < order.size()){
+    if(offset >= window || position + offset >= order.size()){
+      position++;
+      offset = 1;
+      continue;
+    }
+    uint32_t a = order[position], b = order[position + offset];
+    offset++;
+    if((across && (a < split) == (b < split)) || seen_before(a, b)){
+      continue;
+    }
+    if(across){
+      first.push_back(a < split ? a : b);
+      second.push_back((a < split ? b : a) - split);
+    } else {
+      first.push_back(std::min(a, b));
+      second.push_back(std::max(a, b));
+    }
+    found++;
+  }
+  return found;
+}
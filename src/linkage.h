@@ -0,0 +1,86 @@
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "core.h"
+
+#ifndef __POSTER_LINKAGE__
+#define __POSTER_LINKAGE__
+
+// A key per row, held end to end. A row with an empty key has none.
+class key_column {
+
+private:
+
+  poster_string text;
+  std::vector<uint64_t> ends;
+
+public:
+
+  void add(const poster_string& key){
+    text.append(key.data(), key.size());
+    ends.push_back(text.size());
+  }
+
+  size_t rows() const { return ends.size(); }
+
+  const char* data(size_t row) const { return text.data() + (row == 0 ? 0 : ends[row - 1]); }
+
+  size_t size(size_t row) const { return ends[row] - (row == 0 ? 0 : ends[row - 1]); }
+
+  size_t bytes() const { return text.capacity() + ends.capacity() * sizeof(uint64_t); }
+
+};
+
+// Sorts the rows of keys that have one by key, and rows with the same key by
+// row. Rows are radix-partitioned on their keys' first two bytes, and each
+// partition is sorted, on the next six bytes and then the rest of its keys,
+// by threads threads at a time.
+void sort_keys(const key_column& keys, unsigned int threads, std::vector<uint32_t>& order);
+
+// The bytes sort_keys needs beyond its input and output, for rows keys.
+size_t sort_keys_bytes(size_t rows);
+
+// Sorted-neighbourhood linkage: each pass sorts rows on a key, and pairs each
+// row with the window - 1 rows after it. A pair that an earlier pass found is
+// not found again: each pass keeps the rank every row sorted to, and a pair
+// of rows within a window of each other in an earlier pass is skipped.
+//
+// Rows before split are one set and the rest another, and only pairs across
+// the two are found, unless split is the number of rows, when every pair is.
+class sorted_neighbourhood {
+
+private:
+
+  size_t rows;
+  size_t split;
+  unsigned int window;
+  std::vector<std::vector<uint32_t> > ranks;
+  std::vector<uint32_t> order;
+  size_t position;
+  unsigned int offset;
+
+  bool seen_before(uint32_t a, uint32_t b) const;
+
+public:
+
+  sorted_neighbourhood(size_t rows, size_t split, unsigned int window) :
+    rows(rows), split(split), window(window), position(0), offset(1) {}
+
+  // Starts a pass over keys, a key per row.
+  void start_pass(const key_column& keys, unsigned int threads);
+
+  // Appends up to most of the current pass's new pairs to first and second,
+  // ordered within a pair (or, across two sets, with first in the first set
+  // and second counted from the start of the second). Returns how many it
+  // appended, which is fewer than most only once the pass is done.
+  size_t next_pairs(size_t most, std::vector<uint32_t>& first, std::vector<uint32_t>& second);
+
+  // The passes started so far, and the current one's number, from 0.
+  size_t passes() const { return ranks.size(); }
+
+  // The memory held by each pass's ranks and the current order.
+  size_t bytes() const { return (ranks.size() * rows + order.capacity()) * sizeof(uint32_t); }
+
+};
+
+#endif
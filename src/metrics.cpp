@@ -0,0 +1,368 @@
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "metrics.h"
+
+struct counter_info {
+  const char* family;
+  const char* help;
+  const char* labels;
+};
+
+static const counter_info counter_infos[COUNTER_COUNT] = {
+  {"poster_rows_total", "Addresses run through libpostal.", "mode=\"parse\""},
+  {"poster_rows_total", "Addresses run through libpostal.", "mode=\"normalise\""},
+  {"poster_row_failures_total", "Addresses libpostal failed on, by what became of them.", "status=\"retried\""},
+  {"poster_row_failures_total", "Addresses libpostal failed on, by what became of them.", "status=\"invalid_utf8\""},
+  {"poster_row_failures_total", "Addresses libpostal failed on, by what became of them.", "status=\"failed\""},
+  {"poster_rows_transcoded_total", "Addresses transcoded to UTF-8 from latin1 or the native encoding.", ""},
+  {"poster_requests_total", "Requests made of the service.", "lane=\"interactive\""},
+  {"poster_requests_total", "Requests made of the service.", "lane=\"bulk\""},
+  {"poster_rejections_total", "Requests the service turned away.", "reason=\"queue_full\""},
+  {"poster_rejections_total", "Requests the service turned away.", "reason=\"overloaded\""},
+  {"poster_rejections_total", "Requests the service turned away.", "reason=\"stopping\""},
+  {"poster_rejections_total", "Requests the service turned away.", "reason=\"too_many_connections\""},
+  {"poster_coalesced_requests_total", "Requests answered with an identical request's result from the same batch.", ""},
+  {"poster_cache_hits_total", "Rows answered from an identical row's result rather than run.", "cache=\"dedup\""},
+  {"poster_cache_hits_total", "Rows answered from an identical row's result rather than run.", "cache=\"service\""},
+  {"poster_cache_misses_total", "Rows looked up that had to be run.", "cache=\"dedup\""},
+  {"poster_cache_misses_total", "Rows looked up that had to be run.", "cache=\"service\""},
+  {"poster_batches_total", "Batches the service has run.", ""},
+  {"poster_errors_total", "Requests that failed.", ""}
+};
+
+static const char* histogram_labels[HISTOGRAM_COUNT] = {
+  "lane=\"interactive\"",
+  "lane=\"bulk\""
+};
+
+static const double bucket_bounds[METRICS_BUCKETS] = {
+  0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5
+};
+
+metrics_shard::metrics_shard() : in_use(true) {
+  for(unsigned int i = 0; i < COUNTER_COUNT; i++){
+    counters[i] = 0;
+  }
+  for(unsigned int h = 0; h < HISTOGRAM_COUNT; h++){
+    for(unsigned int b = 0; b <= METRICS_BUCKETS; b++){
+      buckets[h][b] = 0;
+    }
+    nanoseconds[h] = 0;
+  }
+}
+
+static std::mutex shards_mutex;
+static std::vector<metrics_shard*> shards;
+
+// A model worker forked while another thread held shards_mutex would inherit
+// it held for good, and hang on its first count. Forking waits for it to be
+// free instead, and holds it across the fork.
+static void lock_shards(){ shards_mutex.lock(); }
+static void unlock_shards(){ shards_mutex.unlock(); }
+static int shards_fork_handlers = pthread_atfork(lock_shards, unlock_shards, unlock_shards);
+
+// Hands a thread's shard back when the thread exits.
+struct shard_release {
+  metrics_shard* shard;
+  shard_release() : shard(NULL) {}
+  ~shard_release(){
+    if(shard != NULL){
+      std::lock_guard<std::mutex> lock(shards_mutex);
+      shard->in_use = false;
+    }
+  }
+};
+
+static thread_local shard_release release;
+
+thread_local metrics_shard* metrics::local = NULL;
+std::mutex metrics::gauges_mutex;
+std::function<void(std::vector<metrics_gauge>&)> metrics::gauges;
+
+metrics_shard* metrics::attach(){
+  std::lock_guard<std::mutex> lock(shards_mutex);
+  metrics_shard* shard = NULL;
+  for(unsigned int i = 0; i < shards.size() && shard == NULL; i++){
+    if(!shards[i]->in_use){
+      shard = shards[i];
+      shard->in_use = true;
+    }
+  }
+  if(shard == NULL){
+    shard = new metrics_shard();
+    shards.push_back(shard);
+  }
+  local = shard;
+  release.shard = shard;
+  return shard;
+}
+
+void metrics::observe(poster_histogram histogram, std::chrono::nanoseconds elapsed){
+  metrics_shard* shard = local != NULL ? local : attach();
+  double seconds = elapsed.count() / 1e9;
+  unsigned int bucket = 0;
+  while(bucket < METRICS_BUCKETS && seconds > bucket_bounds[bucket]){
+    bucket++;
+  }
+  shard->buckets[histogram][bucket].fetch_add(1, std::memory_order_relaxed);
+  shard->nanoseconds[histogram].fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+void metrics::set_gauges(std::function<void(std::vector<metrics_gauge>&)> provider){
+  std::lock_guard<std::mutex> lock(gauges_mutex);
+  gauges = provider;
+}
+
+// Appends a sample line, with its labels if it has any.
+static void sample(std::string& output, const char* name, const char* suffix, const std::string& labels,
+                   const char* extra, const char* value){
+  output += name;
+  output += suffix;
+  if(!labels.empty() || extra != NULL){
+    output += '{';
+    output += labels;
+    if(extra != NULL){
+      if(!labels.empty()){
+        output += ',';
+      }
+      output += extra;
+    }
+    output += '}';
+  }
+  output += ' ';
+  output += value;
+  output += '\n';
+}
+
+static void family(std::string& output, const char* name, const char* help, const char* type){
+  output += std::string("# HELP ") + name + " " + help + "\n";
+  output += std::string("# TYPE ") + name + " " + type + "\n";
+}
+
+void metrics::totals(uint64_t* counters){
+  std::lock_guard<std::mutex> lock(shards_mutex);
+  for(unsigned int i = 0; i < COUNTER_COUNT; i++){
+    counters[i] = 0;
+    for(unsigned int s = 0; s < shards.size(); s++){
+      counters[i] += shards[s]->counters[i].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+std::string metrics::render(){
+  uint64_t counters[COUNTER_COUNT] = {0};
+  uint64_t buckets[HISTOGRAM_COUNT][METRICS_BUCKETS + 1] = {{0}};
+  uint64_t nanoseconds[HISTOGRAM_COUNT] = {0};
+  {
+    std::lock_guard<std::mutex> lock(shards_mutex);
+    for(unsigned int s = 0; s < shards.size(); s++){
+      for(unsigned int i = 0; i < COUNTER_COUNT; i++){
+        counters[i] += shards[s]->counters[i].load(std::memory_order_relaxed);
+      }
+      for(unsigned int h = 0; h < HISTOGRAM_COUNT; h++){
+        for(unsigned int b = 0; b <= METRICS_BUCKETS; b++){
+          buckets[h][b] += shards[s]->buckets[h][b].load(std::memory_order_relaxed);
+        }
+        nanoseconds[h] += shards[s]->nanoseconds[h].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::string output;
+  char value[64];
+  for(unsigned int i = 0; i < COUNTER_COUNT; i++){
+    if(i == 0 || strcmp(counter_infos[i].family, counter_infos[i - 1].family) != 0){
+      family(output, counter_infos[i].family, counter_infos[i].help, "counter");
+    }
+    snprintf(value, sizeof(value), "%llu", (unsigned long long) counters[i]);
+    sample(output, counter_infos[i].family, "", counter_infos[i].labels, NULL, value);
+  }
+
+  const char* name = "poster_request_duration_seconds";
+  family(output, name, "Time from a request reaching the service to its response.", "histogram");
+  for(unsigned int h = 0; h < HISTOGRAM_COUNT; h++){
+    uint64_t cumulative = 0;
+    char bound[64];
+    for(unsigned int b = 0; b <= METRICS_BUCKETS; b++){
+      cumulative += buckets[h][b];
+      if(b < METRICS_BUCKETS){
+        snprintf(bound, sizeof(bound), "le=\"%g\"", bucket_bounds[b]);
+      } else {
+        snprintf(bound, sizeof(bound), "le=\"+Inf\"");
+      }
+      snprintf(value, sizeof(value), "%llu", (unsigned long long) cumulative);
+      sample(output, name, "_bucket", histogram_labels[h], bound, value);
+    }
+    snprintf(value, sizeof(value), "%.9g", nanoseconds[h] / 1e9);
+    sample(output, name, "_sum", histogram_labels[h], NULL, value);
+    snprintf(value, sizeof(value), "%llu", (unsigned long long) cumulative);
+    sample(output, name, "_count", histogram_labels[h], NULL, value);
+  }
+
+  std::vector<metrics_gauge> values;
+  {
+    std::lock_guard<std::mutex> lock(gauges_mutex);
+    if(gauges){
+      gauges(values);
+    }
+  }
+  for(unsigned int i = 0; i < values.size(); i++){
+    if(i == 0 || strcmp(values[i].name, values[i - 1].name) != 0){
+      family(output, values[i].name, values[i].help, "gauge");
+    }
+    snprintf(value, sizeof(value), "%.17g", values[i].value);
+    sample(output, values[i].name, "", values[i].labels, NULL, value);
+  }
+  return output;
+}
+
+bool metrics_exporter::serve(int port, std::string& error){
+  if(running){
+    error = "Metrics are already being exported";
+    return false;
+  }
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  int reuse = 1;
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(listen_fd < 0 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+     bind(listen_fd, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+     listen(listen_fd, 16) != 0 || pipe(wake_fds) != 0){
+    error = "Could not listen on port " + std::to_string(port) + ": " + strerror(errno);
+    if(listen_fd >= 0){
+      close(listen_fd);
+      listen_fd = -1;
+    }
+    return false;
+  }
+  running = true;
+  thread = std::thread(&metrics_exporter::serve_loop, this);
+  return true;
+}
+
+bool metrics_exporter::write(const std::string& path, std::chrono::milliseconds interval, std::string& error){
+  if(running){
+    error = "Metrics are already being exported";
+    return false;
+  }
+  this->path = path;
+  this->interval = interval;
+  running = true;
+  thread = std::thread(&metrics_exporter::write_loop, this);
+  return true;
+}
+
+void metrics_exporter::stop(){
+  if(!running.exchange(false)){
+    return;
+  }
+  if(listen_fd >= 0){
+    char wake = 0;
+    if(::write(wake_fds[1], &wake, 1) < 0){
+      shutdown(listen_fd, SHUT_RDWR);
+    }
+    thread.join();
+    close(listen_fd);
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+    listen_fd = -1;
+  } else {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+    }
+    stopping.notify_all();
+    thread.join();
+  }
+}
+
+// Answers each connection with the metrics, whatever it asked for bar a path
+// other than / or /metrics, and closes it. A client that doesn't send its
+// request within a second is dropped.
+void metrics_exporter::serve_loop(){
+  struct pollfd fds[2];
+  fds[0].fd = listen_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = wake_fds[0];
+  fds[1].events = POLLIN;
+  while(running){
+    if(poll(fds, 2, -1) < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      break;
+    }
+    if(fds[1].revents != 0){
+      break;
+    }
+    if(!(fds[0].revents & POLLIN)){
+      continue;
+    }
+    int fd = accept(listen_fd, NULL, NULL);
+    if(fd < 0){
+      continue;
+    }
+    std::string request;
+    struct pollfd client;
+    client.fd = fd;
+    client.events = POLLIN;
+    while(request.find("\r\n\r\n") == std::string::npos && request.size() < 8192 &&
+          poll(&client, 1, 1000) > 0){
+      char chunk[1024];
+      ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+      if(n <= 0){
+        break;
+      }
+      request.append(chunk, n);
+    }
+
+    std::string status = "200 OK";
+    std::string body;
+    if(request.compare(0, 4, "GET ") != 0){
+      status = "400 Bad Request";
+    } else if(request.compare(4, 2, "/ ") != 0 && request.compare(4, 9, "/metrics ") != 0 &&
+              request.compare(4, 9, "/metrics?") != 0){
+      status = "404 Not Found";
+    } else {
+      body = metrics::render();
+    }
+    std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\n" +
+      "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    size_t sent = 0;
+    while(sent < response.size()){
+      ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if(n <= 0){
+        break;
+      }
+      sent += n;
+    }
+    close(fd);
+  }
+}
+
+// Rewrites the file every interval, by way of a temporary file renamed over
+// it so that readers never see it half written.
+void metrics_exporter::write_loop(){
+  std::string temporary = path + ".tmp";
+  std::unique_lock<std::mutex> lock(mutex);
+  while(running){
+    std::string text = metrics::render();
+    FILE* output = fopen(temporary.c_str(), "w");
+    if(output != NULL){
+      bool written = fwrite(text.data(), 1, text.size(), output) == text.size();
+      if(fclose(output) == 0 && written){
+        rename(temporary.c_str(), path.c_str());
+      }
+    }
+    stopping.wait_for(lock, interval, [this]{ return !running; });
+  }
+}
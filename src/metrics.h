@@ -0,0 +1,145 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef __POSTER_METRICS__
+#define __POSTER_METRICS__
+
+// The counters poster keeps. Consecutive counters of the same family are
+// exported as one metric with different labels; those per lane, per
+// rejection reason and per row status are in the order of service_lane,
+// service_rejection and the POSTER_STATUS_s after POSTER_STATUS_OK. Cache
+// hits and misses are of dedup's table of repeated rows within a call, then
+// of the service's coalescing of identical requests within a batch.
+enum poster_counter {
+  COUNTER_ROWS_PARSED,
+  COUNTER_ROWS_NORMALISED,
+  COUNTER_ROWS_RETRIED,
+  COUNTER_ROWS_INVALID_UTF8,
+  COUNTER_ROWS_FAILED,
+  COUNTER_ROWS_TRANSCODED,
+  COUNTER_REQUESTS_INTERACTIVE,
+  COUNTER_REQUESTS_BULK,
+  COUNTER_REJECTED_QUEUE_FULL,
+  COUNTER_REJECTED_OVERLOADED,
+  COUNTER_REJECTED_STOPPING,
+  COUNTER_REJECTED_CONNECTIONS,
+  COUNTER_COALESCED,
+  COUNTER_CACHE_HITS,
+  COUNTER_CACHE_HITS_SERVICE,
+  COUNTER_CACHE_MISSES,
+  COUNTER_CACHE_MISSES_SERVICE,
+  COUNTER_BATCHES,
+  COUNTER_ERRORS,
+  COUNTER_COUNT
+};
+
+// The latency histograms poster keeps, one per service lane.
+enum poster_histogram {
+  HISTOGRAM_INTERACTIVE,
+  HISTOGRAM_BULK,
+  HISTOGRAM_COUNT
+};
+
+// The number of buckets in each histogram, not counting +Inf.
+#define METRICS_BUCKETS 14
+
+// One thread's counts. Only its own thread writes to it, with relaxed atomic
+// adds to memory no other thread writes (padded, so that neighbouring shards
+// don't share a cache line), so counting takes no lock and doesn't contend;
+// a scrape sums every thread's.
+struct metrics_shard {
+  std::atomic<uint64_t> counters[COUNTER_COUNT];
+  std::atomic<uint64_t> buckets[HISTOGRAM_COUNT][METRICS_BUCKETS + 1];
+  std::atomic<uint64_t> nanoseconds[HISTOGRAM_COUNT];
+  bool in_use;
+  char padding[64];
+  metrics_shard();
+};
+
+// A value read at scrape time rather than counted.
+struct metrics_gauge {
+  const char* name;
+  const char* help;
+  std::string labels;
+  double value;
+};
+
+// Process-wide metrics, exported in Prometheus' text format. A shard is
+// handed to each thread on its first count and back when it exits, and is
+// kept (counts and all) for the next thread, so totals never go backwards.
+class metrics {
+
+private:
+
+  static thread_local metrics_shard* local;
+
+  static metrics_shard* attach();
+
+  static std::mutex gauges_mutex;
+
+  static std::function<void(std::vector<metrics_gauge>&)> gauges;
+
+public:
+
+  static inline void count(poster_counter counter, uint64_t n = 1){
+    metrics_shard* shard = local != NULL ? local : attach();
+    shard->counters[counter].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  static void observe(poster_histogram histogram, std::chrono::nanoseconds elapsed);
+
+  // Sums every thread's counts into totals, which has COUNTER_COUNT entries.
+  static void totals(uint64_t* counters);
+
+  // Sets what is called at each scrape to add gauges.
+  static void set_gauges(std::function<void(std::vector<metrics_gauge>&)> provider);
+
+  // Sums every thread's counts and renders them, with the gauges.
+  static std::string render();
+
+};
+
+// Exports metrics from a background thread, either to Prometheus over HTTP
+// on a port of the loopback interface or by rewriting a file (for
+// node_exporter's textfile collector) every interval.
+class metrics_exporter {
+
+private:
+
+  std::thread thread;
+  std::atomic<bool> running;
+  int listen_fd;
+  int wake_fds[2];
+  std::string path;
+  std::chrono::milliseconds interval;
+  std::mutex mutex;
+  std::condition_variable stopping;
+
+  void serve_loop();
+
+  void write_loop();
+
+public:
+
+  metrics_exporter() : running(false), listen_fd(-1) {}
+
+  ~metrics_exporter(){ stop(); }
+
+  bool serve(int port, std::string& error);
+
+  bool write(const std::string& path, std::chrono::milliseconds interval, std::string& error);
+
+  void stop();
+
+  bool is_running() const { return running; }
+
+};
+
+#endif
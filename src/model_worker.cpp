@@ -0,0 +1,204 @@
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "metrics.h"
+#include "model_worker.h"
+
+static bool write_all(int fd, const char* data, size_t size){
+  while(size > 0){
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, char* data, size_t size){
+  while(size > 0){
+    ssize_t n = read(fd, data, size);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+static void put_string(std::string& output, const std::string& value){
+  uint32_t size = value.size();
+  output.append((const char*) &size, sizeof(size));
+  output += value;
+}
+
+static bool get_string(int fd, std::string& value){
+  uint32_t size;
+  if(!read_all(fd, (char*) &size, sizeof(size))){
+    return false;
+  }
+  value.resize(size);
+  return size == 0 || read_all(fd, &value[0], size);
+}
+
+// Closes every descriptor the child inherited bar stdio and keep, so that it
+// doesn't hold the parent's sockets open after the parent has closed them.
+static void close_inherited(int keep){
+  std::vector<int> inherited;
+  DIR* dir = opendir("/proc/self/fd");
+  if(dir == NULL){
+    return;
+  }
+  struct dirent* entry;
+  while((entry = readdir(dir)) != NULL){
+    int fd = atoi(entry->d_name);
+    if(fd > 2 && fd != keep && fd != dirfd(dir)){
+      inherited.push_back(fd);
+    }
+  }
+  closedir(dir);
+  for(unsigned int i = 0; i < inherited.size(); i++){
+    close(inherited[i]);
+  }
+}
+
+// The child's side: swaps the models it inherited for those in datadir, then
+// answers batches - a count, then a mode byte and address per request - with
+// a response per request until the socket is closed. Each batch's responses
+// are followed by what it added to every counter, for the parent to count,
+// since nothing scrapes the child's own.
+static void worker_main(int fd, const std::string& datadir, int warm_up_rounds){
+  poster_teardown();
+  char ready = poster_setup(datadir) ? 1 : 0;
+  if(ready){
+    poster_warm_up(warm_up_rounds);
+  }
+  if(!write_all(fd, &ready, 1) || !ready){
+    _exit(1);
+  }
+
+  service_scratch scratch;
+  std::string address;
+  std::string response;
+  std::string output;
+  uint32_t count;
+  uint64_t counted[COUNTER_COUNT], totals[COUNTER_COUNT];
+  metrics::totals(counted);
+  while(read_all(fd, (char*) &count, sizeof(count))){
+    output.clear();
+    for(uint32_t i = 0; i < count; i++){
+      char mode;
+      if(!read_all(fd, &mode, 1) || !get_string(fd, address)){
+        _exit(1);
+      }
+      service_respond(mode, address, scratch, response);
+      put_string(output, response);
+    }
+    metrics::totals(totals);
+    for(unsigned int i = 0; i < COUNTER_COUNT; i++){
+      uint64_t added = totals[i] - counted[i];
+      output.append((const char*) &added, sizeof(added));
+      counted[i] = totals[i];
+    }
+    if(!write_all(fd, output.data(), output.size())){
+      _exit(1);
+    }
+  }
+  _exit(0);
+}
+
+bool model_worker::start(const std::string& datadir, int warm_up_rounds, std::string& error){
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0){
+    error = std::string("Could not create a socket for the model worker: ") + strerror(errno);
+    return false;
+  }
+
+  // Fork while holding libpostal_mutex, so that no other thread is part way
+  // through a call into libpostal when the child's copy of it is taken; the
+  // child is left with just this thread, which can then release it.
+  {
+    std::lock_guard<std::mutex> lock(libpostal_mutex);
+    pid = fork();
+  }
+  if(pid == 0){
+    close_inherited(fds[1]);
+    signal(SIGINT, SIG_IGN);
+    worker_main(fds[1], datadir, warm_up_rounds);
+  }
+  close(fds[1]);
+  if(pid < 0){
+    close(fds[0]);
+    error = std::string("Could not fork a model worker: ") + strerror(errno);
+    return false;
+  }
+  fd = fds[0];
+
+  char ready = 0;
+  if(!read_all(fd, &ready, 1) || !ready){
+    error = "The model worker could not load libpostal's models from " +
+      (datadir.empty() ? std::string("its default data directory") : datadir);
+    return false;
+  }
+  return true;
+}
+
+model_worker::~model_worker(){
+  if(fd >= 0){
+    close(fd);
+  }
+  if(pid > 0){
+    waitpid(pid, NULL, 0);
+  }
+}
+
+bool model_worker::run(const std::vector<service_request*>& requests, std::vector<std::string>& responses,
+                       service_scratch& scratch){
+  responses.resize(requests.size());
+  if(pid < 0){
+    for(unsigned int i = 0; i < requests.size(); i++){
+      service_respond(requests[i]->mode, requests[i]->address, scratch, responses[i]);
+    }
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  batch.clear();
+  uint32_t count = requests.size();
+  batch.append((const char*) &count, sizeof(count));
+  for(unsigned int i = 0; i < requests.size(); i++){
+    batch += (char) requests[i]->mode;
+    put_string(batch, requests[i]->address);
+  }
+  if(!write_all(fd, batch.data(), batch.size())){
+    return false;
+  }
+  for(unsigned int i = 0; i < requests.size(); i++){
+    if(!get_string(fd, responses[i])){
+      return false;
+    }
+  }
+  uint64_t added[COUNTER_COUNT];
+  if(!read_all(fd, (char*) added, sizeof(added))){
+    return false;
+  }
+  for(unsigned int i = 0; i < COUNTER_COUNT; i++){
+    if(added[i] > 0){
+      metrics::count((poster_counter) i, added[i]);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,49 @@
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "service.h"
+
+#ifndef __POSTER_MODEL_WORKER__
+#define __POSTER_MODEL_WORKER__
+
+// How long reloading waits for batches still running on the old models to
+// finish before giving up on them.
+#define POSTER_DRAIN_SECONDS 60
+
+// A child process with its own copy of libpostal's models, loaded from a
+// data directory, that runs batches of service requests sent to it over a
+// socket. Starting one loads and warms up new models while this process's
+// go on serving; the child exits once the last reference to it is dropped.
+// One that hasn't been started runs requests here, on this process's models.
+class model_worker {
+
+private:
+
+  pid_t pid;
+  int fd;
+  std::mutex mutex;
+  std::string batch;
+
+public:
+
+  model_worker() : pid(-1), fd(-1) {}
+
+  ~model_worker();
+
+  // Forks the worker and waits for it to load its models from datadir and
+  // run warm_up_rounds of poster_warm_up, returning false and setting error
+  // if it couldn't.
+  bool start(const std::string& datadir, int warm_up_rounds, std::string& error);
+
+  // Runs requests in the worker, writing a response for each to responses.
+  // Returns false if the worker has gone.
+  bool run(const std::vector<service_request*>& requests, std::vector<std::string>& responses,
+           service_scratch& scratch);
+
+  // The worker's process, or -1 if it runs requests in this one.
+  long process_id() const { return pid > 0 ? pid : -1; }
+
+};
+
+#endif
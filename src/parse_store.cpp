@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <stdlib.h>
+#include <unistd.h>
+#include "parse_store.h"
+
+#define POSTER_STORE_MAGIC "PSTORE01"
+
+static void put_varint(std::vector<uint8_t>& data, uint64_t value){
+  while(value >= 0x80){
+    data.push_back((uint8_t) (value | 0x80));
+    value >>= 7;
+  }
+  data.push_back((uint8_t) value);
+}
+
+static uint64_t get_varint(const uint8_t*& data){
+  uint64_t value = 0;
+  unsigned int shift = 0;
+  while(*data & 0x80){
+    value |= ((uint64_t) (*data++ & 0x7f)) << shift;
+    shift += 7;
+  }
+  value |= ((uint64_t) *data++) << shift;
+  return value;
+}
+
+// Likewise, for data read from a file: returns false rather than reading past
+// end or decoding more than 64 bits.
+static bool get_varint(const uint8_t*& data, const uint8_t* end, uint64_t& value){
+  value = 0;
+  for(unsigned int shift = 0; data < end && shift < 64; shift += 7){
+    value |= ((uint64_t) (*data & 0x7f)) << shift;
+    if(!(*data++ & 0x80)){
+      return true;
+    }
+  }
+  return false;
+}
+
+// The bytes left in input after its current position.
+static uint64_t bytes_left(FILE* input){
+  off_t position = ftello(input);
+  if(position < 0 || fseeko(input, 0, SEEK_END) != 0){
+    return 0;
+  }
+  off_t end = ftello(input);
+  if(fseeko(input, position, SEEK_SET) != 0 || end < position){
+    return 0;
+  }
+  return end - position;
+}
+
+template <typename T>
+static void save_vector(FILE* output, const std::vector<T>& values){
+  uint64_t size = values.size();
+  fwrite(&size, sizeof(size), 1, output);
+  if(size > 0){
+    fwrite(values.data(), sizeof(T), size, output);
+  }
+}
+
+// Reads a vector written by save_vector, refusing one that claims to be
+// larger than what is left of the file, rather than allocating for it.
+template <typename T>
+static bool load_vector(FILE* input, std::vector<T>& values){
+  uint64_t size;
+  if(fread(&size, sizeof(size), 1, input) != 1 || size > bytes_left(input) / sizeof(T)){
+    return false;
+  }
+  values.resize(size);
+  return size == 0 || fread(values.data(), sizeof(T), size, input) == size;
+}
+
+void front_coded_dictionary::build(const std::vector<std::string>& sorted){
+  data.clear();
+  bucket_offsets.clear();
+  count = sorted.size();
+  for(uint32_t i = 0; i < count; i++){
+    size_t shared = 0;
+    if(i % POSTER_BUCKET_SIZE == 0){
+      bucket_offsets.push_back(data.size());
+    } else {
+      const std::string& previous = sorted[i - 1];
+      size_t limit = std::min(previous.size(), sorted[i].size());
+      while(shared < limit && previous[shared] == sorted[i][shared]){
+        shared++;
+      }
+    }
+    put_varint(data, shared);
+    put_varint(data, sorted[i].size() - shared);
+    data.insert(data.end(), sorted[i].begin() + shared, sorted[i].end());
+  }
+  data.shrink_to_fit();
+  bucket_offsets.shrink_to_fit();
+}
+
+void front_coded_dictionary::get(uint32_t index, std::string& output) const {
+  const uint8_t* position = data.data() + bucket_offsets[index / POSTER_BUCKET_SIZE];
+  output.clear();
+  for(uint32_t i = 0; i <= index % POSTER_BUCKET_SIZE; i++){
+    uint64_t shared = get_varint(position);
+    uint64_t suffix = get_varint(position);
+    output.resize(shared);
+    output.append((const char*) position, suffix);
+    position += suffix;
+  }
+}
+
+size_t front_coded_dictionary::bytes() const {
+  return data.capacity() + (bucket_offsets.capacity() * sizeof(uint64_t));
+}
+
+void front_coded_dictionary::save(FILE* output) const {
+  fwrite(&count, sizeof(count), 1, output);
+  save_vector(output, bucket_offsets);
+  save_vector(output, data);
+}
+
+// Checks every bucket decodes within the data, with each string sharing no
+// more than its predecessor has, so that get() can trust it.
+bool front_coded_dictionary::load(FILE* input){
+  if(fread(&count, sizeof(count), 1, input) != 1 || !load_vector(input, bucket_offsets) ||
+     !load_vector(input, data) || bucket_offsets.size() != ((uint64_t) count + POSTER_BUCKET_SIZE - 1) / POSTER_BUCKET_SIZE){
+    return false;
+  }
+  const uint8_t* end = data.data() + data.size();
+  for(size_t b = 0; b < bucket_offsets.size(); b++){
+    uint64_t bucket_end = b + 1 < bucket_offsets.size() ? bucket_offsets[b + 1] : data.size();
+    if(bucket_offsets[b] > bucket_end || bucket_end > data.size()){
+      return false;
+    }
+    const uint8_t* position = data.data() + bucket_offsets[b];
+    uint64_t previous = 0;
+    for(uint32_t i = b * POSTER_BUCKET_SIZE; i < count && i < (b + 1) * POSTER_BUCKET_SIZE; i++){
+      uint64_t shared, suffix;
+      if(!get_varint(position, end, shared) || !get_varint(position, end, suffix) || shared > previous ||
+         suffix > (uint64_t) (end - position)){
+        return false;
+      }
+      position += suffix;
+      previous = shared + suffix;
+    }
+  }
+  return true;
+}
+
+// Sizes the codes for count values no greater than largest, all zero.
+void packed_codes::reset(size_t count, uint32_t largest){
+  width = 0;
+  while(width < 32 && (((uint64_t) 1) << width) <= largest){
+    width++;
+  }
+  this->count = count;
+  words.assign(((count * width) + 63) / 64 + 1, 0);
+}
+
+size_t packed_codes::bytes() const {
+  return words.capacity() * sizeof(uint64_t);
+}
+
+void packed_codes::save(FILE* output) const {
+  uint64_t stored_count = count;
+  fwrite(&width, sizeof(width), 1, output);
+  fwrite(&stored_count, sizeof(stored_count), 1, output);
+  save_vector(output, words);
+}
+
+bool packed_codes::load(FILE* input){
+  uint64_t stored_count;
+  if(fread(&width, sizeof(width), 1, input) != 1 || fread(&stored_count, sizeof(stored_count), 1, input) != 1){
+    return false;
+  }
+  count = stored_count;
+  return load_vector(input, words) && width <= 32 && count <= words.size() * 64 &&
+    words.size() * 64 >= count * width;
+}
+
+// Every code must be one of the dictionary's, or 0.
+bool packed_codes::within(uint32_t largest) const {
+  for(size_t i = 0; i < count; i++){
+    if(get(i) > largest){
+      return false;
+    }
+  }
+  return true;
+}
+
+parse_store::builder::~builder(){
+  if(spill_file != NULL){
+    fclose(spill_file);
+  }
+}
+
+// Appends the codes held in memory to the spill file as one batch, a column
+// per component, and frees them. The file is unlinked as soon as it's opened,
+// so it goes away with the builder however the build ends.
+void parse_store::builder::spill(){
+  uint64_t batch_rows = codes[0].size();
+  if(batch_rows == 0){
+    return;
+  }
+  if(spill_file == NULL){
+    std::string path = (spill_dir.empty() ? std::string("/tmp") : spill_dir) + "/poster_spill_XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    int fd = mkstemp(name.data());
+    if(fd < 0 || (spill_file = fdopen(fd, "w+b")) == NULL){
+      throw std::runtime_error("Could not create a spill file in " + spill_dir);
+    }
+    unlink(name.data());
+  }
+  if(fseeko(spill_file, 0, SEEK_END) != 0){
+    throw std::runtime_error("Could not write to the spill file");
+  }
+  spilled.push_back(std::make_pair((uint64_t) ftello(spill_file), batch_rows));
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    if(fwrite(codes[n].data(), sizeof(uint32_t), batch_rows, spill_file) != batch_rows){
+      throw std::runtime_error("Could not write to the spill file");
+    }
+    std::vector<uint32_t>().swap(codes[n]);
+  }
+  spilled_rows += batch_rows;
+}
+
+void parse_store::builder::check_budget(){
+  if(budget > 0 && (codes[0].size() * PARSER_LABEL_COUNT * sizeof(uint32_t)) > budget){
+    spill();
+  }
+}
+
+void parse_store::builder::add(const parsed_address& address){
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    const poster_string& component = address.components[n];
+    if(component.empty()){
+      codes[n].push_back(0);
+    } else {
+      std::pair<std::unordered_map<std::string, uint32_t>::iterator, bool> entry =
+        ids[n].insert(std::make_pair(std::string(component.data(), component.size()), ids[n].size() + 1));
+      codes[n].push_back(entry.first->second);
+    }
+  }
+  check_budget();
+}
+
+void parse_store::builder::add_missing(){
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    codes[n].push_back(0);
+  }
+  check_budget();
+}
+
+// Sorts each component's distinct values, renumbers the rows' codes to match
+// and encodes both, reading spilled codes back a batch at a time. The builder
+// is emptied as it goes.
+void parse_store::builder::finish(parse_store& store){
+  if(spill_file != NULL){
+    spill();
+  }
+  store.rows = spilled_rows + codes[0].size();
+  store.spilled_bytes = spilled_rows * PARSER_LABEL_COUNT * sizeof(uint32_t);
+  std::vector<uint32_t> batch;
+
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    std::vector<std::pair<std::string, uint32_t> > values(ids[n].begin(), ids[n].end());
+    std::unordered_map<std::string, uint32_t>().swap(ids[n]);
+    std::sort(values.begin(), values.end());
+
+    std::vector<uint32_t> renumbered(values.size() + 1, 0);
+    std::vector<std::string> sorted(values.size());
+    for(uint32_t i = 0; i < values.size(); i++){
+      renumbered[values[i].second] = i + 1;
+      sorted[i].swap(values[i].first);
+    }
+    std::vector<std::pair<std::string, uint32_t> >().swap(values);
+    store.dictionaries[n].build(sorted);
+    store.codes[n].reset(store.rows, sorted.size());
+
+    size_t row = 0;
+    for(unsigned int b = 0; b < spilled.size(); b++){
+      uint64_t batch_rows = spilled[b].second;
+      batch.resize(batch_rows);
+      if(fseeko(spill_file, spilled[b].first + (n * batch_rows * sizeof(uint32_t)), SEEK_SET) != 0 ||
+         fread(batch.data(), sizeof(uint32_t), batch_rows, spill_file) != batch_rows){
+        throw std::runtime_error("Could not read back the spill file");
+      }
+      for(uint64_t i = 0; i < batch_rows; i++){
+        store.codes[n].set(row++, renumbered[batch[i]]);
+      }
+    }
+    for(size_t i = 0; i < codes[n].size(); i++){
+      store.codes[n].set(row++, renumbered[codes[n][i]]);
+    }
+    std::vector<uint32_t>().swap(codes[n]);
+  }
+}
+
+bool parse_store::get(size_t row, int component, std::string& output) const {
+  uint32_t code = codes[component].get(row);
+  if(code == 0){
+    output.clear();
+    return false;
+  }
+  dictionaries[component].get(code - 1, output);
+  return true;
+}
+
+size_t parse_store::bytes() const {
+  size_t total = sizeof(parse_store);
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    total += dictionaries[n].bytes() + codes[n].bytes();
+  }
+  return total;
+}
+
+bool parse_store::save(const std::string& path) const {
+  FILE* output = fopen(path.c_str(), "wb");
+  if(output == NULL){
+    return false;
+  }
+  uint64_t stored_rows = rows;
+  uint32_t components = PARSER_LABEL_COUNT;
+  fwrite(POSTER_STORE_MAGIC, 1, 8, output);
+  fwrite(&stored_rows, sizeof(stored_rows), 1, output);
+  fwrite(&components, sizeof(components), 1, output);
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    dictionaries[n].save(output);
+    codes[n].save(output);
+  }
+  bool written = !ferror(output);
+  return (fclose(output) == 0) && written;
+}
+
+bool parse_store::load(const std::string& path){
+  FILE* input = fopen(path.c_str(), "rb");
+  if(input == NULL){
+    return false;
+  }
+  char magic[8];
+  uint64_t stored_rows;
+  uint32_t components;
+  bool loaded = fread(magic, 1, 8, input) == 8 && memcmp(magic, POSTER_STORE_MAGIC, 8) == 0 &&
+    fread(&stored_rows, sizeof(stored_rows), 1, input) == 1 &&
+    fread(&components, sizeof(components), 1, input) == 1 && components == PARSER_LABEL_COUNT;
+  for(unsigned int n = 0; loaded && n < PARSER_LABEL_COUNT; n++){
+    loaded = dictionaries[n].load(input) && codes[n].load(input) && codes[n].size() == stored_rows &&
+      codes[n].within(dictionaries[n].size());
+  }
+  fclose(input);
+  if(loaded){
+    rows = stored_rows;
+  }
+  return loaded;
+}
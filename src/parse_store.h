@@ -0,0 +1,177 @@
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "core.h"
+#include "governor.h"
+
+#ifndef __POSTER_PARSE_STORE__
+#define __POSTER_PARSE_STORE__
+
+// Strings per front-coded bucket. Larger buckets compress better; smaller
+// ones make random access cheaper.
+#define POSTER_BUCKET_SIZE 16
+
+// A sorted dictionary of strings, front-coded: within each bucket, every
+// string after the first is stored as the length of the prefix it shares
+// with its predecessor plus the remaining suffix.
+class front_coded_dictionary {
+
+private:
+
+  std::vector<uint8_t> data;
+  std::vector<uint64_t> bucket_offsets;
+  uint32_t count;
+
+public:
+
+  front_coded_dictionary() : count(0) {}
+
+  void build(const std::vector<std::string>& sorted);
+
+  void get(uint32_t index, std::string& output) const;
+
+  uint32_t size() const { return count; }
+
+  size_t bytes() const;
+
+  void save(FILE* output) const;
+
+  bool load(FILE* input);
+
+};
+
+// Unsigned codes packed at the smallest bit width that holds the largest.
+class packed_codes {
+
+private:
+
+  std::vector<uint64_t> words;
+  unsigned int width;
+  size_t count;
+
+public:
+
+  packed_codes() : width(0), count(0) {}
+
+  void reset(size_t count, uint32_t largest);
+
+  inline void set(size_t index, uint32_t code){
+    if(width == 0){
+      return;
+    }
+    size_t bit = index * width;
+    size_t word = bit >> 6;
+    unsigned int offset = bit & 63;
+    words[word] |= ((uint64_t) code) << offset;
+    if(offset + width > 64){
+      words[word + 1] |= ((uint64_t) code) >> (64 - offset);
+    }
+  }
+
+  inline uint32_t get(size_t index) const {
+    if(width == 0){
+      return 0;
+    }
+    size_t bit = index * width;
+    size_t word = bit >> 6;
+    unsigned int offset = bit & 63;
+    uint64_t value = words[word] >> offset;
+    if(offset + width > 64){
+      value |= words[word + 1] << (64 - offset);
+    }
+    return (uint32_t) (value & ((((uint64_t) 1) << width) - 1));
+  }
+
+  size_t size() const { return count; }
+
+  // Whether every code is no greater than largest.
+  bool within(uint32_t largest) const;
+
+  size_t bytes() const;
+
+  void save(FILE* output) const;
+
+  bool load(FILE* input);
+
+};
+
+// Parsed addresses held compactly: each component is dictionary-encoded
+// against a front-coded dictionary of its distinct values, and each row
+// holds a bit-packed code per component, 0 meaning the component is missing.
+// Any row's components can be read back without decoding the others.
+class parse_store {
+
+private:
+
+  front_coded_dictionary dictionaries[PARSER_LABEL_COUNT];
+  packed_codes codes[PARSER_LABEL_COUNT];
+  size_t rows;
+  uint64_t spilled_bytes;
+  std::unique_ptr<memory_grant> grant;
+
+public:
+
+  // Collects rows as they are parsed, then encodes them all at once. Once
+  // the rows' codes take up more than the budget, they are moved out to a
+  // temporary columnar file a batch at a time and read back, in order, when
+  // the store is encoded. The dictionaries themselves stay in memory.
+  class builder {
+
+  private:
+
+    std::unordered_map<std::string, uint32_t> ids[PARSER_LABEL_COUNT];
+    std::vector<uint32_t> codes[PARSER_LABEL_COUNT];
+    size_t budget;
+    std::string spill_dir;
+    FILE* spill_file;
+    std::vector<std::pair<uint64_t, uint64_t> > spilled;
+    uint64_t spilled_rows;
+
+    void spill();
+
+    void check_budget();
+
+  public:
+
+    builder(size_t budget = 0, const std::string& spill_dir = "") :
+      budget(budget), spill_dir(spill_dir), spill_file(NULL), spilled_rows(0) {}
+
+    ~builder();
+
+    void add(const parsed_address& address);
+
+    void add_missing();
+
+    void finish(parse_store& store);
+
+  };
+
+  parse_store() : rows(0), spilled_bytes(0) {}
+
+  size_t size() const { return rows; }
+
+  // Writes a row's component to output, returning false if it is missing.
+  bool get(size_t row, int component, std::string& output) const;
+
+  uint32_t distinct(int component) const { return dictionaries[component].size(); }
+
+  size_t bytes() const;
+
+  // Draws the memory the store holds from the resource governor, for as
+  // long as the store lives, once it has been built or loaded.
+  void govern(){ grant.reset(new memory_grant(bytes())); }
+
+  // How much was moved out to disk while the store was being built.
+  uint64_t spilled() const { return spilled_bytes; }
+
+  bool save(const std::string& path) const;
+
+  // Reads a store written by save(), returning false if the file isn't one
+  // or is damaged. Nothing it claims is trusted until it has been checked.
+  bool load(const std::string& path);
+
+};
+
+#endif
@@ -1,352 +1,1779 @@
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <unordered_set>
 #include "postal.h"
+#include "governor.h"
+#include "join.h"
+#include "linkage.h"
+#include "metrics.h"
+#include "sanitise.h"
+#include "transcode.h"
 
-String poster_internal::isna(std::string x){
-  if(x == ""){
+// Column names for parse_addr's output, indexed by label.
+const char* poster_internal::column_names[PARSER_LABEL_COUNT] = {
+  "house",
+  "category",
+  "near",
+  "house_number",
+  "road",
+  "unit",
+  "level",
+  "staircase",
+  "entrance",
+  "po_box",
+  "postal_code",
+  "suburb",
+  "city_district",
+  "city",
+  "island",
+  "state_district",
+  "state",
+  "country_region",
+  "country",
+  "world_region"
+};
+
+// The order those columns appear in, which isn't quite libpostal's.
+const int poster_internal::column_order[PARSER_LABEL_COUNT] = {
+  PARSER_LABEL_HOUSE,
+  PARSER_LABEL_CATEGORY,
+  PARSER_LABEL_NEAR,
+  PARSER_LABEL_HOUSE_NUMBER,
+  PARSER_LABEL_ROAD,
+  PARSER_LABEL_UNIT,
+  PARSER_LABEL_LEVEL,
+  PARSER_LABEL_STAIRCASE,
+  PARSER_LABEL_ENTRANCE,
+  PARSER_LABEL_PO_BOX,
+  PARSER_LABEL_SUBURB,
+  PARSER_LABEL_CITY_DISTRICT,
+  PARSER_LABEL_CITY,
+  PARSER_LABEL_ISLAND,
+  PARSER_LABEL_STATE_DISTRICT,
+  PARSER_LABEL_STATE,
+  PARSER_LABEL_POSTCODE,
+  PARSER_LABEL_COUNTRY_REGION,
+  PARSER_LABEL_COUNTRY,
+  PARSER_LABEL_WORLD_REGION
+};
+
+SEXP poster_internal::isna(const poster_string& x){
+  if(x.empty()){
     return NA_STRING;
   }
-  return x;
-}
-
-enum {
-    PARSER_LABEL_HOUSE,
-    PARSER_LABEL_CATEGORY,
-    PARSER_LABEL_NEAR,
-    PARSER_LABEL_HOUSE_NUMBER,
-    PARSER_LABEL_ROAD,
-    PARSER_LABEL_UNIT,
-    PARSER_LABEL_LEVEL,
-    PARSER_LABEL_STAIRCASE,
-    PARSER_LABEL_ENTRANCE,
-    PARSER_LABEL_PO_BOX,
-    PARSER_LABEL_POSTCODE,
-    PARSER_LABEL_SUBURB,
-    PARSER_LABEL_CITY_DISTRICT,
-    PARSER_LABEL_CITY,
-    PARSER_LABEL_ISLAND,
-    PARSER_LABEL_STATE_DISTRICT,
-    PARSER_LABEL_STATE,
-    PARSER_LABEL_COUNTRY_REGION,
-    PARSER_LABEL_COUNTRY,
-    PARSER_LABEL_WORLD_REGION
-};
+  memory_accounting::count_r_vector(x.size() + 1);
+  return Rf_mkCharLenCE(x.data(), x.size(), CE_UTF8);
+}
 
-CharacterVector poster_internal::parse_single(String x, address_parser_options_t& opts){
-  CharacterVector output(10, NA_STRING);
-  libpostal_address_parser_response_t *parsed = libpostal_parse_address((char*) x.get_cstring(), opts);
-  std::string holding;
-  for (unsigned int n = 0; n < parsed->num_components; n++) {
-    holding = parsed->labels[n];
+// A data.frame of all-NA component columns in parse_addr's order, with each
+// column also made available in columns, indexed by label.
+List poster_internal::component_frame(unsigned int rows, SEXP* columns, bool lazy){
+  List output(PARSER_LABEL_COUNT);
+  CharacterVector names(PARSER_LABEL_COUNT);
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    int label = column_order[n];
+    if(lazy){
+      columns[label] = R_NilValue;
+    } else {
+      output[n] = CharacterVector(rows, NA_STRING);
+      columns[label] = output[n];
+    }
+    names[n] = column_names[label];
+  }
+  if(!lazy){
+    memory_accounting::count_r_vector(PARSER_LABEL_COUNT * rows * sizeof(SEXP));
+  }
+  output.attr("names") = names;
+  output.attr("class") = "data.frame";
+  output.attr("row.names") = IntegerVector::create(NA_INTEGER, -((int) rows));
+  return output;
+}
 
-    // Optimise this by using an enum
-    if (holding == "house") {
-      output[PARSER_LABEL_HOUSE] = isna(parsed->components[n]);
+void poster_internal::read_chunk(CharacterVector& addresses, unsigned int start, unsigned int end,
+                                 scratch_buffers& scratch, int64_t chunk, bool sanitise){
+  Rcpp::checkUserInterrupt();
+  memory_accounting::sample_rss();
+  trace_scope trace("read", chunk);
+  stage_scope scope(STAGE_READ);
+  std::vector<const char*>& inputs = scratch.inputs;
+  // libpostal takes UTF-8, so rows R holds as latin1 or, outside a UTF-8
+  // locale, in the native encoding are noted as they're read and then
+  // transcoded an encoding at a time.
+  bool native_utf8 = poster_native_is_utf8();
+  std::vector<unsigned int> latin1, native;
+  for(unsigned int i = start; i < end; i++){
+    SEXP address = STRING_ELT(addresses, i);
+    if(address == NA_STRING){
+      inputs[i - start] = NULL;
+      continue;
     }
-    if (holding == "category") {
-      output[PARSER_LABEL_CATEGORY] = isna(parsed->components[n]);
+    inputs[i - start] = CHAR(address);
+    cetype_t encoding = Rf_getCharCE(address);
+    if(encoding == CE_LATIN1){
+      latin1.push_back(i);
+    } else if(encoding == CE_NATIVE && !native_utf8 && !IS_ASCII(address)){
+      native.push_back(i);
     }
-    if (holding == "near") {
-      output[PARSER_LABEL_NEAR] = isna(parsed->components[n]);
+  }
+  if(!latin1.empty() || !native.empty()){
+    poster_string& arena = scratch.transcoded;
+    arena.clear();
+    std::vector<std::pair<unsigned int, size_t> > transcoded;
+    for(size_t n = 0; n < latin1.size(); n++){
+      SEXP address = STRING_ELT(addresses, latin1[n]);
+      transcoded.push_back(std::make_pair(latin1[n], arena.size()));
+      poster_latin1_to_utf8(CHAR(address), LENGTH(address), arena);
+      arena.push_back('\0');
     }
-    if (holding == "house_number") {
-      output[PARSER_LABEL_HOUSE_NUMBER] = isna(parsed->components[n]);
+    if(!native.empty()){
+      // Rows that aren't valid in the native encoding are left as they are,
+      // for parsing to fail on and the retry to scrub.
+      native_transcoder transcoder;
+      for(size_t n = 0; n < native.size(); n++){
+        SEXP address = STRING_ELT(addresses, native[n]);
+        size_t offset = arena.size();
+        if(transcoder.convert(CHAR(address), LENGTH(address), arena)){
+          transcoded.push_back(std::make_pair(native[n], offset));
+          arena.push_back('\0');
+        }
+      }
     }
-    if (holding == "road") {
-      output[PARSER_LABEL_ROAD] = isna(parsed->components[n]);
+    for(size_t n = 0; n < transcoded.size(); n++){
+      inputs[transcoded[n].first - start] = arena.data() + transcoded[n].second;
     }
-    if (holding == "unit") {
-      output[PARSER_LABEL_UNIT] = isna(parsed->components[n]);
+    metrics::count(COUNTER_ROWS_TRANSCODED, transcoded.size());
+  }
+  if(!sanitise){
+    return;
+  }
+  std::vector<poster_string>& sanitised = scratch.sanitised;
+  if(sanitised.size() < end - start){
+    sanitised.resize(end - start);
+  }
+  for(unsigned int i = start; i < end; i++){
+    SEXP address = STRING_ELT(addresses, i);
+    if(address == NA_STRING){
+      continue;
     }
-    if (holding == "level") {
-      output[PARSER_LABEL_LEVEL] = isna(parsed->components[n]);
+    const char* input = inputs[i - start];
+    size_t size = input == CHAR(address) ? LENGTH(address) : strlen(input);
+    if(poster_sanitise(input, size, sanitised[i - start])){
+      inputs[i - start] = sanitised[i - start].c_str();
     }
-    if (holding == "staircase") {
-      output[PARSER_LABEL_STAIRCASE] = isna(parsed->components[n]);
+  }
+}
+
+const char* poster_internal::utf8_row(SEXP address, poster_string& buffer){
+  cetype_t encoding = Rf_getCharCE(address);
+  if(encoding == CE_LATIN1){
+    buffer.clear();
+    poster_latin1_to_utf8(CHAR(address), LENGTH(address), buffer);
+    return buffer.c_str();
+  }
+  if(encoding == CE_NATIVE && !IS_ASCII(address) && !poster_native_is_utf8()){
+    buffer.clear();
+    native_transcoder transcoder;
+    if(transcoder.convert(CHAR(address), LENGTH(address), buffer)){
+      return buffer.c_str();
     }
-    if (holding == "entrance") {
-      output[PARSER_LABEL_ENTRANCE] = isna(parsed->components[n]);
+  }
+  return CHAR(address);
+}
+
+void poster_internal::write_components(SEXP* columns, unsigned int row, const parsed_address& parsed){
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    if(!parsed.components[n].empty()){
+      SET_STRING_ELT(columns[n], row, isna(parsed.components[n]));
     }
-    if (holding == "po_box") {
-      output[PARSER_LABEL_PO_BOX] = isna(parsed->components[n]);
+  }
+}
+
+static void write_heaps(std::unique_ptr<string_heap>* heaps, unsigned int row, const parsed_address& parsed){
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    if(!parsed.components[n].empty()){
+      heaps[n]->set(row, parsed.components[n].data(), parsed.components[n].size());
     }
-    if (holding == "postcode") {
-      output[PARSER_LABEL_POSTCODE] = isna(parsed->components[n]);
+  }
+}
+
+// The normaliser's options for a retry: only the transformations that don't
+// go through its language-specific dictionaries and transliterators.
+normalize_options_t poster_internal::retry_options(){
+  normalize_options_t options = libpostal_get_default_options();
+  options.latin_ascii = false;
+  options.transliterate = false;
+  options.strip_accents = false;
+  options.decompose = false;
+  options.expand_numex = false;
+  options.roman_numerals = false;
+  return options;
+}
+
+const char* poster_internal::scrubbed_row(SEXP address, poster_string& transcoded, poster_string& output){
+  poster_scrub(utf8_row(address, transcoded), output);
+  return output.c_str();
+}
+
+void poster_internal::record_status(SEXP output, unsigned int rows, const std::vector<unsigned int>& failed,
+                                    const std::vector<int>& statuses, const char* verb){
+  if(failed.empty()){
+    return;
+  }
+  IntegerVector status(rows, POSTER_STATUS_OK + 1);
+  CharacterVector levels(POSTER_STATUS_COUNT);
+  for(unsigned int n = 0; n < POSTER_STATUS_COUNT; n++){
+    levels[n] = status_names[n];
+  }
+  size_t unrecovered = 0;
+  for(size_t n = 0; n < failed.size(); n++){
+    status[failed[n]] = statuses[n] + 1;
+    metrics::count((poster_counter) (COUNTER_ROWS_RETRIED + statuses[n] - POSTER_STATUS_RETRIED));
+    if(statuses[n] != POSTER_STATUS_RETRIED){
+      unrecovered++;
     }
-    if (holding == "suburb") {
-      output[PARSER_LABEL_SUBURB] = isna(parsed->components[n]);
+  }
+  status.attr("levels") = levels;
+  status.attr("class") = "factor";
+  Rf_setAttrib(output, Rf_install("status"), status);
+  if(unrecovered > 0){
+    Rcpp::warning(std::to_string(unrecovered) + " addresses could not be " + verb +
+                  " and are NA; see addr_status()");
+  }
+}
+
+// About what an entry in the table of rows seen takes, which is drawn from the
+// resource governor.
+#define POSTER_PLAN_ENTRY_BYTES 48
+
+// Whether a row that repeats row source can be copied from it, which it can't
+// if source failed: the repeat is then run, and retried, in its own right.
+static bool copies_earlier_row(const std::vector<unsigned int>& failed, unsigned int& source){
+  if(source == poster_internal::NO_REPEAT){
+    return false;
+  }
+  if(std::binary_search(failed.begin(), failed.end(), source)){
+    source = poster_internal::NO_REPEAT;
+    return false;
+  }
+  return true;
+}
+
+void poster_internal::find_repeats(CharacterVector& addresses, const std::vector<const char*>& inputs,
+                                   unsigned int start, unsigned int end, repeat_table& seen,
+                                   std::vector<unsigned int>& repeats){
+  uint64_t hits = 0, misses = 0;
+  for(unsigned int i = start; i < end; i++){
+    repeats[i - start] = NO_REPEAT;
+    if(inputs[i - start] == NULL){
+      continue;
     }
-    if (holding == "city_district") {
-      output[PARSER_LABEL_CITY_DISTRICT] = isna(parsed->components[n]);
+    if(seen.by_text){
+      seen.key.assign(inputs[i - start]);
+      std::unordered_map<std::string, unsigned int>::const_iterator found = seen.texts.find(seen.key);
+      if(found != seen.texts.end()){
+        repeats[i - start] = found->second;
+      } else if(seen.used + POSTER_PLAN_ENTRY_BYTES + seen.key.size() <= seen.budget){
+        seen.used += POSTER_PLAN_ENTRY_BYTES + seen.key.size();
+        seen.texts.emplace(seen.key, i);
+      }
+    } else {
+      SEXP address = STRING_ELT(addresses, i);
+      std::unordered_map<SEXP, unsigned int>::const_iterator found = seen.rows.find(address);
+      if(found != seen.rows.end()){
+        repeats[i - start] = found->second;
+      } else if(seen.used + POSTER_PLAN_ENTRY_BYTES <= seen.budget){
+        seen.used += POSTER_PLAN_ENTRY_BYTES;
+        seen.rows.emplace(address, i);
+      }
     }
-    if (holding == "city") {
-      output[PARSER_LABEL_CITY] = isna(parsed->components[n]);
+    if(repeats[i - start] != NO_REPEAT){
+      POSTER_PROBE2(cache_hit, i, repeats[i - start]);
+      hits++;
+    } else {
+      POSTER_PROBE1(cache_miss, i);
+      misses++;
     }
-    if (holding == "island") {
-      output[PARSER_LABEL_ISLAND] = isna(parsed->components[n]);
+  }
+  metrics::count(COUNTER_CACHE_HITS, hits);
+  metrics::count(COUNTER_CACHE_MISSES, misses);
+}
+
+CharacterVector poster_internal::address_normalise(CharacterVector addresses, bool sanitise,
+                                                   const engine_plan& plan){
+
+  call_accounting accounting;
+  unsigned int input_size = addresses.size();
+  CharacterVector output(input_size);
+  memory_accounting::count_r_vector(input_size * sizeof(SEXP));
+  normalize_options_t options = libpostal_get_default_options();
+  unsigned int chunk_size = plan.chunk_size;
+  scratch_lease scratch(chunk_rows(input_size, chunk_size));
+  std::vector<const char*>& inputs = scratch->inputs;
+  std::vector<poster_string>& expanded = scratch->strings;
+  std::vector<unsigned int> failed;
+  std::vector<int> statuses;
+  std::vector<unsigned int> repeats(plan.dedup ? chunk_size : 0);
+  memory_grant cache(plan.dedup ? plan.cache_entries * POSTER_PLAN_ENTRY_BYTES : 0);
+  repeat_table seen(sanitise, cache.bytes());
+  int status;
+
+  for(unsigned int start = 0; start < input_size; start += chunk_size){
+
+    unsigned int end = std::min(input_size, start + chunk_size);
+    int64_t chunk = start / chunk_size;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk, sanitise);
+    if(plan.dedup){
+      find_repeats(addresses, inputs, start, end, seen, repeats);
     }
-    if (holding == "state_district") {
-      output[PARSER_LABEL_STATE_DISTRICT] = isna(parsed->components[n]);
+    size_t next_failed = failed.size();
+
+    {
+      trace_scope trace("expand", chunk);
+      stage_scope scope(STAGE_EXPAND);
+      for(unsigned int i = start; i < end; i++){
+        expanded[i - start].clear();
+        if(inputs[i - start] == NULL || (plan.dedup && copies_earlier_row(failed, repeats[i - start]))){
+          continue;
+        }
+        poster_expand(inputs[i - start], options, expanded[i - start], &status);
+        if(status != POSTER_STATUS_OK){
+          failed.push_back(i);
+          statuses.push_back(status);
+        }
+      }
     }
-    if (holding == "state") {
-      output[PARSER_LABEL_STATE] = isna(parsed->components[n]);
+
+    trace_scope trace("write", chunk);
+    stage_scope scope(STAGE_WRITE);
+    for(unsigned int i = start; i < end; i++){
+      if(next_failed < failed.size() && failed[next_failed] == i){
+        next_failed++;
+        SET_STRING_ELT(output, i, NA_STRING);
+      } else if(inputs[i - start] == NULL){
+        SET_STRING_ELT(output, i, NA_STRING);
+      } else if(plan.dedup && repeats[i - start] != NO_REPEAT){
+        SET_STRING_ELT(output, i, STRING_ELT(output, repeats[i - start]));
+      } else if(expanded[i - start].empty()){
+        SEXP address = STRING_ELT(addresses, i);
+        SET_STRING_ELT(output, i, inputs[i - start] == CHAR(address) ? address : Rf_mkCharCE(inputs[i - start], CE_UTF8));
+      } else {
+        SET_STRING_ELT(output, i, isna(expanded[i - start]));
+      }
     }
-    if (holding == "country_region") {
-      output[PARSER_LABEL_COUNTRY_REGION] = isna(parsed->components[n]);
+  }
+
+  // Rows that failed go round again once every other row is done, scrubbed
+  // and with only the normaliser's simpler transformations.
+  if(!failed.empty()){
+    trace_scope trace("retry", 0);
+    normalize_options_t strict = retry_options();
+    poster_string& expansion = expanded[0];
+    for(size_t n = 0; n < failed.size(); n++){
+      unsigned int i = failed[n];
+      poster_scrub(utf8_row(STRING_ELT(addresses, i), scratch->transcoded), scratch->text);
+      bool found = poster_expand(scratch->text.c_str(), strict, expansion, &status);
+      if(status == POSTER_STATUS_OK){
+        statuses[n] = POSTER_STATUS_RETRIED;
+        SET_STRING_ELT(output, i, found ? isna(expansion) : isna(scratch->text));
+      }
     }
-    if (holding == "country") {
-      output[PARSER_LABEL_COUNTRY] = isna(parsed->components[n]);
+  }
+  record_status(output, input_size, failed, statuses, "normalised");
+
+  memory_accounting::sample_rss();
+  return output;
+}
+
+std::vector<int> poster_internal::label_list(CharacterVector columns){
+  std::vector<int> labels;
+  for(unsigned int i = 0; i < columns.size(); i++){
+    const char* name = columns[i] == NA_STRING ? "NA" : CHAR(STRING_ELT(columns, i));
+    int label = -1;
+    for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+      if(strcmp(name, column_names[n]) == 0){
+        label = n;
+      }
     }
-    if (holding == "world_region") {
-      output[PARSER_LABEL_WORLD_REGION] = isna(parsed->components[n]);
+    if(label < 0){
+      Rcpp::stop(std::string("There is no component called ") + name);
     }
+    labels.push_back(label);
   }
+  return labels;
+}
 
-  libpostal_address_parser_response_destroy(parsed);
-  return output;
+uint32_t poster_internal::label_mask(CharacterVector columns){
+  std::vector<int> labels = label_list(columns);
+  uint32_t mask = 0;
+  for(unsigned int i = 0; i < labels.size(); i++){
+    mask |= 1u << labels[i];
+  }
+  return mask;
 }
 
-CharacterVector poster_internal::address_normalise(CharacterVector addresses){
-  
-  unsigned int input_size = addresses.size();
-  CharacterVector output(input_size);
-  normalize_options_t options = libpostal_get_default_options();
-  size_t num_expansions;
-  char **expansions;
-  
-  for(unsigned int i = 0; i < input_size; i++){
-    
-    if((i % 10000) == 0){
-      Rcpp::checkUserInterrupt();
+// Normalises the components of parsed whose labels are in mask, each with
+// libpostal's options for its kind of component, keeping any that have no
+// expansion as they were parsed.
+static void normalise_components(parsed_address& parsed, uint32_t mask, libpostal_normalize_options_t& options,
+                                 poster_string& expansion){
+  for(unsigned int label = 0; label < PARSER_LABEL_COUNT; label++){
+    if((mask & (1u << label)) == 0 || parsed.components[label].empty()){
+      continue;
     }
-    
-    if(addresses[i] == NA_STRING){
-      
-      output[i] = NA_STRING;
-      
-    } else {
-      
-      expansions = libpostal_expand_address(addresses[i], options, &num_expansions);
-      if(num_expansions == 0){
-        output[i] = addresses[i];
-      } else {
-        output[i] = std::string(expansions[0]);
-      }
-      
-      libpostal_expansion_array_destroy(expansions, num_expansions);
-      
+    options.address_components = label_components[label];
+    if(poster_expand(parsed.components[label].c_str(), options, expansion)){
+      parsed.components[label].swap(expansion);
     }
   }
-  
-  return output;
 }
 
-DataFrame poster_internal::parse_addr(CharacterVector addresses){
-  
+DataFrame poster_internal::parse_addr(CharacterVector addresses, bool sanitise, const engine_plan& plan,
+                                      uint32_t normalise, bool lazy){
+
+  call_accounting accounting;
   unsigned int input_size = addresses.size();
-  CharacterVector house(input_size, NA_STRING);
-  CharacterVector category(input_size, NA_STRING);
-  CharacterVector near(input_size, NA_STRING);
-  CharacterVector house_number(input_size, NA_STRING);
-  CharacterVector road(input_size, NA_STRING);
-  CharacterVector unit(input_size, NA_STRING);
-  CharacterVector level(input_size, NA_STRING);
-  CharacterVector staircase(input_size, NA_STRING);
-  CharacterVector entrance(input_size, NA_STRING);
-  CharacterVector po_box(input_size, NA_STRING);
-  CharacterVector suburb(input_size, NA_STRING);
-  CharacterVector city_district(input_size, NA_STRING);
-  CharacterVector city(input_size, NA_STRING);
-  CharacterVector island(input_size, NA_STRING);
-  CharacterVector state_district(input_size, NA_STRING);
-  CharacterVector state(input_size, NA_STRING);
-  CharacterVector postal_code(input_size, NA_STRING);
-  CharacterVector country(input_size, NA_STRING);
-  CharacterVector country_region(input_size, NA_STRING);
-  CharacterVector world_region(input_size, NA_STRING);
-  CharacterVector holding;
+  SEXP columns[PARSER_LABEL_COUNT];
+  List output = component_frame(input_size, columns, lazy);
+  // Lazily, components go to a heap per column rather than into R's string
+  // cache, and a row that repeats an earlier one shares its text.
+  std::unique_ptr<string_heap> heaps[PARSER_LABEL_COUNT];
+  if(lazy){
+    for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+      heaps[n].reset(new string_heap(input_size));
+    }
+  }
 
   libpostal_address_parser_options_t options = libpostal_get_address_parser_default_options();
+  libpostal_normalize_options_t normalise_options = libpostal_get_default_options();
+  unsigned int chunk_size = plan.chunk_size;
+  scratch_lease scratch(chunk_rows(input_size, chunk_size));
+  std::vector<const char*>& inputs = scratch->inputs;
+  std::vector<parsed_address>& parsed = scratch->parsed;
+  std::vector<unsigned int> failed;
+  std::vector<int> statuses;
+  std::vector<unsigned int> repeats(plan.dedup ? chunk_size : 0);
+  memory_grant cache(plan.dedup ? plan.cache_entries * POSTER_PLAN_ENTRY_BYTES : 0);
+  repeat_table seen(sanitise, cache.bytes());
 
-  for(unsigned int i = 0; i < input_size; i++){
-    if((i % 10000) == 0){
-      Rcpp::checkUserInterrupt();
+  for(unsigned int start = 0; start < input_size; start += chunk_size){
+
+    unsigned int end = std::min(input_size, start + chunk_size);
+    int64_t chunk = start / chunk_size;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk, sanitise);
+    if(plan.dedup){
+      find_repeats(addresses, inputs, start, end, seen, repeats);
     }
-    if(addresses[i] != NA_STRING){
-      address_parser_response_t *parsed = libpostal_parse_address((char*) addresses[i],
-                                                                  options);
-      std::string holding;
-      for (unsigned int n = 0; n < parsed->num_components; n++) {
-        holding = parsed->labels[n];
-        // Optimise this by using an enum
-        if (holding == "house") {
-          house[i] = isna(parsed->components[n]);
-        }
-        if (holding == "category") {
-          category[i] = isna(parsed->components[n]);
-        }
-        if (holding == "near") {
-          near[i] = isna(parsed->components[n]);
-        }
-        if (holding == "house_number") {
-          house_number[i] = isna(parsed->components[n]);
-        }
-        if (holding == "road") {
-          road[i] = isna(parsed->components[n]);
-        }
-        if (holding == "unit") {
-          unit[i] = isna(parsed->components[n]);
-        }
-        if (holding == "level") {
-          level[i] = isna(parsed->components[n]);
-        }
-        if (holding == "staircase") {
-          staircase[i] = isna(parsed->components[n]);
-        }
-        if (holding == "entrance") {
-          entrance[i] = isna(parsed->components[n]);
-        }
-        if (holding == "po_box") {
-          po_box[i] = isna(parsed->components[n]);
-        }
-        if (holding == "suburb") {
-          suburb[i] = isna(parsed->components[n]);
-        }
-        if (holding == "city_district") {
-          city_district[i] = isna(parsed->components[n]);
-        }
-        if (holding == "city") {
-          city[i] = isna(parsed->components[n]);
-        }
-        if (holding == "island") {
-          island[i] = isna(parsed->components[n]);
+
+    {
+      trace_scope trace("parse", chunk);
+      for(unsigned int i = start; i < end; i++){
+        if(inputs[i - start] == NULL || (plan.dedup && copies_earlier_row(failed, repeats[i - start]))){
+          continue;
         }
-        if (holding == "state_district") {
-          state_district[i] = isna(parsed->components[n]);
+        int status = poster_parse(inputs[i - start], options, parsed[i - start]);
+        if(status != POSTER_STATUS_OK){
+          failed.push_back(i);
+          statuses.push_back(status);
+        } else if(normalise != 0){
+          normalise_components(parsed[i - start], normalise, normalise_options, scratch->text);
         }
-        if (holding == "state") {
-          state[i] = isna(parsed->components[n]);
+      }
+    }
+
+    trace_scope trace("convert", chunk);
+    stage_scope scope(STAGE_CONVERT);
+    for(unsigned int i = start; i < end; i++){
+      if(inputs[i - start] == NULL){
+        continue;
+      }
+      if(plan.dedup && repeats[i - start] != NO_REPEAT){
+        for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+          if(lazy){
+            heaps[n]->copy(i, repeats[i - start]);
+          } else {
+            SET_STRING_ELT(columns[n], i, STRING_ELT(columns[n], repeats[i - start]));
+          }
         }
-        if (holding == "postcode") {
-          postal_code[i] = isna(parsed->components[n]);
+      } else if(lazy){
+        write_heaps(heaps, i, parsed[i - start]);
+      } else {
+        write_components(columns, i, parsed[i - start]);
+      }
+    }
+  }
+
+  // Rows that failed go round again once every other row is done, scrubbed
+  // of what isn't valid UTF-8 and of control characters.
+  if(!failed.empty()){
+    trace_scope trace("retry", 0);
+    for(size_t n = 0; n < failed.size(); n++){
+      const char* scrubbed = scrubbed_row(STRING_ELT(addresses, failed[n]), scratch->transcoded, scratch->text);
+      if(poster_parse(scrubbed, options, parsed[0]) == POSTER_STATUS_OK){
+        statuses[n] = POSTER_STATUS_RETRIED;
+        normalise_components(parsed[0], normalise, normalise_options, scratch->text);
+        if(lazy){
+          write_heaps(heaps, failed[n], parsed[0]);
+        } else {
+          write_components(columns, failed[n], parsed[0]);
         }
-        if (holding == "country_region") {
-          country_region[i] = isna(parsed->components[n]);
+      }
+    }
+  }
+  if(lazy){
+    for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+      output[n] = make_string_column(heaps[column_order[n]].release());
+    }
+  }
+  record_status(output, input_size, failed, statuses, "parsed");
+
+  memory_accounting::sample_rss();
+  return DataFrame(output);
+}
+
+CharacterVector poster_internal::sanitise_addr(CharacterVector addresses){
+
+  call_accounting accounting;
+  unsigned int input_size = addresses.size();
+  CharacterVector output(input_size);
+  memory_accounting::count_r_vector(input_size * sizeof(SEXP));
+  scratch_lease scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  std::vector<const char*>& inputs = scratch->inputs;
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk, true);
+
+    trace_scope trace("write", chunk);
+    stage_scope scope(STAGE_WRITE);
+    for(unsigned int i = start; i < end; i++){
+      SEXP address = STRING_ELT(addresses, i);
+      if(inputs[i - start] == NULL || inputs[i - start] == CHAR(address)){
+        SET_STRING_ELT(output, i, address);
+      } else {
+        SET_STRING_ELT(output, i, Rf_mkCharCE(inputs[i - start], CE_UTF8));
+      }
+    }
+  }
+
+  memory_accounting::sample_rss();
+  return output;
+}
+
+// Finds token in address from position from onwards, ignoring case as far as
+// poster_lower folds it, returning where it starts (and setting end to where
+// it ends, which a capital lowercased to fewer bytes can move) or npos if it
+// can't be found.
+static size_t find_token(const char* address, size_t address_size, size_t from,
+                         const char* token, size_t token_size, size_t& end){
+  const unsigned char* a = (const unsigned char*) address;
+  const unsigned char* t = (const unsigned char*) token;
+  if(token_size == 0){
+    return poster_string::npos;
+  }
+  for(size_t start = from; start < address_size; start++){
+    size_t i = start, n = 0;
+    while(n < token_size && i < address_size){
+      if(a[i] < 0x80 && t[n] < 0x80){
+        if(tolower(a[i]) != tolower(t[n])){
+          break;
         }
-        if (holding == "country") {
-          country[i] = isna(parsed->components[n]);
+        i++;
+        n++;
+        continue;
+      }
+      uint32_t x, y;
+      size_t x_length = poster_utf8_decode(a + i, address_size - i, x);
+      size_t y_length = poster_utf8_decode(t + n, token_size - n, y);
+      if(x_length == 0 || y_length == 0 || poster_lower(x) != poster_lower(y)){
+        break;
+      }
+      i += x_length;
+      n += y_length;
+    }
+    if(n == token_size){
+      end = i;
+      return start;
+    }
+  }
+  return poster_string::npos;
+}
+
+// The number of characters in the size bytes of UTF-8 at x: every byte but
+// continuation bytes starts one.
+static size_t utf8_characters(const char* x, size_t size){
+  size_t characters = 0;
+  for(size_t i = 0; i < size; i++){
+    characters += ((unsigned char) x[i] & 0xC0) != 0x80;
+  }
+  return characters;
+}
+
+// Parses addresses into every labelled component in order, flattened across
+// rows: row i's tokens are row_offsets[i] up to row_offsets[i + 1], each with
+// its label, its text and its span in the address, where it could be found
+// there. Spans are found in the row as UTF-8 and given in characters, which
+// transcoding keeps, so that they index the address as R holds it, in
+// whatever encoding. Tokens are appended row by row, so a row that fails is
+// retried there and then, scrubbed, and its spans are found in the scrubbed
+// text and mapped back through the scrub to the bytes they came from.
+List poster_internal::parse_tokens(CharacterVector addresses){
+
+  call_accounting accounting;
+  unsigned int input_size = addresses.size();
+  IntegerVector row_offsets(input_size + 1);
+  std::vector<int> labels;
+  std::vector<int> starts;
+  std::vector<int> ends;
+  std::vector<size_t> value_ends;
+  poster_string heap;
+
+  int positions[PARSER_LABEL_COUNT];
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    positions[column_order[n]] = n + 1;
+  }
+
+  libpostal_address_parser_options_t options = libpostal_get_address_parser_default_options();
+  scratch_lease scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  std::vector<const char*>& inputs = scratch->inputs;
+  parsed_tokens tokens;
+  poster_string scrubbed;
+  std::vector<size_t> sources;
+  std::vector<unsigned int> failed;
+  std::vector<int> statuses;
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk);
+
+    trace_scope trace("parse", chunk);
+    for(unsigned int i = start; i < end; i++){
+      row_offsets[i] = labels.size();
+      if(inputs[i - start] == NULL){
+        continue;
+      }
+      const char* original = inputs[i - start];
+      const char* input = original;
+      int status = poster_parse_tokens(input, options, tokens);
+      bool retried = status != POSTER_STATUS_OK;
+      if(retried){
+        poster_scrub(original, scrubbed, &sources);
+        input = scrubbed.c_str();
+        failed.push_back(i);
+        statuses.push_back(poster_parse_tokens(input, options, tokens) == POSTER_STATUS_OK ?
+                           (int) POSTER_STATUS_RETRIED : status);
+      }
+      size_t address_size = strlen(input);
+      size_t original_size = retried ? strlen(original) : address_size;
+      size_t cursor = 0;
+      // Spans are found in order, so bytes of the original are counted into
+      // characters as the search moves on; rows that are all ASCII need no
+      // counting.
+      bool ascii = poster_ascii_prefix(original, original_size) == original_size;
+      size_t counted_bytes = 0, counted_characters = 0;
+      auto characters_to = [&](size_t byte){
+        if(ascii){
+          return byte;
         }
-        if (holding == "world_region") {
-          world_region[i] = isna(parsed->components[n]);
+        counted_characters += utf8_characters(original + counted_bytes, byte - counted_bytes);
+        counted_bytes = byte;
+        return counted_characters;
+      };
+      for(size_t n = 0; n < tokens.labels.size(); n++){
+        size_t token_start = n == 0 ? 0 : tokens.ends[n - 1];
+        size_t token_size = tokens.ends[n] - token_start;
+        labels.push_back(tokens.labels[n] < 0 ? NA_INTEGER : positions[tokens.labels[n]]);
+        heap.append(tokens.text, token_start, token_size);
+        value_ends.push_back(heap.size());
+        size_t found = find_token(input, address_size, cursor,
+                                  tokens.text.data() + token_start, token_size, cursor);
+        if(found == poster_string::npos){
+          starts.push_back(NA_INTEGER);
+          ends.push_back(NA_INTEGER);
+        } else if(retried){
+          starts.push_back(characters_to(sources[found]));
+          ends.push_back(characters_to(sources[cursor - 1] + 1));
+        } else {
+          starts.push_back(characters_to(found));
+          ends.push_back(characters_to(cursor));
         }
-
       }
-      libpostal_address_parser_response_destroy(parsed);
     }
   }
+  row_offsets[input_size] = labels.size();
+
+  trace_scope trace("convert", 0);
+  stage_scope scope(STAGE_CONVERT);
+  size_t token_count = labels.size();
+  IntegerVector label(labels.begin(), labels.end());
+  IntegerVector span_start(starts.begin(), starts.end());
+  IntegerVector span_end(ends.begin(), ends.end());
+  CharacterVector value(token_count);
+  memory_accounting::count_r_vector(token_count * (3 * sizeof(int) + sizeof(SEXP)));
+  for(size_t n = 0; n < token_count; n++){
+    size_t value_start = n == 0 ? 0 : value_ends[n - 1];
+    SET_STRING_ELT(value, n, Rf_mkCharLenCE(heap.data() + value_start, value_ends[n] - value_start, CE_UTF8));
+  }
+  CharacterVector levels(PARSER_LABEL_COUNT);
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    levels[n] = column_names[column_order[n]];
+  }
+  label.attr("levels") = levels;
+  label.attr("class") = "factor";
 
-  return DataFrame::create(_["house"] = house,
-                           _["category"] = category,
-                           _["near"] = near,
-                           _["house_number"] = house_number,
-                           _["road"] = road,
-                           _["unit"] = unit,
-                           _["level"] = level,
-                           _["staircase"] = staircase,
-                           _["entrance"] = entrance,
-                           _["po_box"] = po_box,
-                           _["suburb"] = suburb,
-                           _["city_district"] = city_district,
-                           _["city"] = city,
-                           _["island"] = island,
-                           _["state_district"] = state_district,
-                           _["state"] = state,
-                           _["postal_code"] = postcode,
-                           _["country_region"] = country_region,
-                           _["country"] = country,
-                           _["world_region"] = world_region,
-                           _["stringsAsFactors"] = false);
+  List output = List::create(_["row_offsets"] = row_offsets, _["label"] = label, _["value"] = value,
+                             _["start"] = span_start, _["end"] = span_end);
+  record_status(output, input_size, failed, statuses, "parsed");
+  memory_accounting::sample_rss();
+  return output;
 }
 
 CharacterVector poster_internal::get_elements(CharacterVector addresses, int element){
-  
+
+  if(element < 0 || element >= PARSER_LABEL_COUNT){
+    Rcpp::stop("element must be a valid address component");
+  }
+  call_accounting accounting;
   unsigned int input_size = addresses.size();
   CharacterVector output(input_size);
-  
+  memory_accounting::count_r_vector(input_size * sizeof(SEXP));
+
   libpostal_address_parser_options_t options = libpostal_get_address_parser_default_options();
   libpostal_address_parser_options_t& opt_ref = options;
-  
-  for(unsigned int i = 0; i < input_size; i++){
-    if((i % 10000) == 0){
-      Rcpp::checkUserInterrupt();
+  scratch_lease scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  std::vector<const char*>& inputs = scratch->inputs;
+  std::vector<parsed_address>& parsed = scratch->parsed;
+  std::vector<unsigned int> failed;
+  std::vector<int> statuses;
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk);
+
+    {
+      trace_scope trace("parse", chunk);
+      for(unsigned int i = start; i < end; i++){
+        if(inputs[i - start] != NULL){
+          int status = poster_parse(inputs[i - start], opt_ref, parsed[i - start]);
+          if(status != POSTER_STATUS_OK){
+            failed.push_back(i);
+            statuses.push_back(status);
+          }
+        }
+      }
     }
-    
-    if(addresses[i] == NA_STRING){
-      output[i] = NA_STRING;
-    } else {
-      output[i] = parse_single(addresses[i], opt_ref)[element];
+
+    trace_scope trace("convert", chunk);
+    stage_scope scope(STAGE_CONVERT);
+    for(unsigned int i = start; i < end; i++){
+      if(inputs[i - start] == NULL){
+        SET_STRING_ELT(output, i, NA_STRING);
+      } else {
+        SET_STRING_ELT(output, i, isna(parsed[i - start].components[element]));
+      }
     }
-  
+
   }
-  
+
+  // Failed rows were left NA, and go round again scrubbed, as in parse_addr.
+  if(!failed.empty()){
+    trace_scope trace("retry", 0);
+    for(size_t n = 0; n < failed.size(); n++){
+      const char* scrubbed = scrubbed_row(STRING_ELT(addresses, failed[n]), scratch->transcoded, scratch->text);
+      if(poster_parse(scrubbed, opt_ref, parsed[0]) == POSTER_STATUS_OK){
+        statuses[n] = POSTER_STATUS_RETRIED;
+        SET_STRING_ELT(output, failed[n], isna(parsed[0].components[element]));
+      }
+    }
+  }
+  record_status(output, input_size, failed, statuses, "parsed");
+
+  memory_accounting::sample_rss();
   return output;
-    
+
 }
 
-CharacterVector poster_internal::set_elements(CharacterVector addresses, CharacterVector new_value, int element){
-  
+// Replaces each address's element with new_value. With a country, the
+// address is rebuilt from its components with that country's template;
+// otherwise the element's text is spliced out of the address and the new
+// value spliced in, leaving the address as it was if the element's text
+// can't be found in it.
+CharacterVector poster_internal::set_elements(CharacterVector addresses, CharacterVector new_value, int element,
+                                              std::string country){
+
+  if(element < 0 || element >= PARSER_LABEL_COUNT){
+    Rcpp::stop("element must be a valid address component");
+  }
   unsigned int input_size = addresses.size();
+  bool single_value = (new_value.size() == 1);
+  if(!single_value && new_value.size() != input_size){
+    Rcpp::stop("The set of new values must be the same length as the addresses, or of length 1");
+  }
+  if(single_value && new_value[0] == NA_STRING){
+    return addresses;
+  }
+
+  call_accounting accounting;
   CharacterVector output(input_size);
-  CharacterVector holding;
+  memory_accounting::count_r_vector(input_size * sizeof(SEXP));
   libpostal_address_parser_options_t options = libpostal_get_address_parser_default_options();
   libpostal_address_parser_options_t& opt_ref = options;
-  
-  if(new_value.size() == 1){
-    if(new_value[0] == NA_STRING){
-      return addresses;
-    }
-    for(unsigned int i = 0; i < input_size; i++){
-      if((i % 10000) == 0){
-        Rcpp::checkUserInterrupt();
-      }
-      
-      if(addresses[i] == NA_STRING){
-        output[i] = NA_STRING;
+  scratch_lease scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  std::vector<const char*>& inputs = scratch->inputs;
+  std::vector<parsed_address>& parsed = scratch->parsed;
+  poster_string& addr_cp = scratch->text;
+  address_formats formats;
+  const address_template& format = formats.lookup(country.c_str());
+  component_view view;
+  std::vector<unsigned int> failed;
+  std::vector<int> statuses;
+  poster_string scrubbed;
+  poster_string transcoded;
+
+  // Writes row i of the output, from the address as it was parsed and the
+  // replacement as UTF-8, as the address is.
+  auto write_row = [&](unsigned int i, const char* input, const parsed_address& address, SEXP replacement){
+    const char* value = utf8_row(replacement, transcoded);
+    size_t value_size = value == CHAR(replacement) ? LENGTH(replacement) : transcoded.size();
+    if(!country.empty()){
+      view.set(address);
+      view.data[element] = value;
+      view.size[element] = value_size;
+      format.render(view, ", ", addr_cp);
+      SET_STRING_ELT(output, i, isna(addr_cp));
+      return;
+    }
+    const poster_string& component = address.components[element];
+    addr_cp = input;
+    size_t position = component.empty() ? poster_string::npos : addr_cp.find(component);
+    if(position == poster_string::npos){
+      SET_STRING_ELT(output, i, STRING_ELT(addresses, i));
+    } else {
+      addr_cp.replace(position, component.size(), value, value_size);
+      SET_STRING_ELT(output, i, isna(addr_cp));
+    }
+  };
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk);
+    size_t next_failed = failed.size();
+
+    {
+      trace_scope trace("parse", chunk);
+      for(unsigned int i = start; i < end; i++){
+        SEXP replacement = STRING_ELT(new_value, single_value ? 0 : i);
+        if(inputs[i - start] != NULL && replacement != NA_STRING){
+          int status = poster_parse(inputs[i - start], opt_ref, parsed[i - start]);
+          if(status != POSTER_STATUS_OK){
+            failed.push_back(i);
+            statuses.push_back(status);
+          }
+        }
+      }
+    }
+
+    trace_scope trace("write", chunk);
+    stage_scope scope(STAGE_WRITE);
+    for(unsigned int i = start; i < end; i++){
+      SEXP replacement = STRING_ELT(new_value, single_value ? 0 : i);
+      if(inputs[i - start] == NULL){
+        SET_STRING_ELT(output, i, NA_STRING);
+      } else if(replacement == NA_STRING){
+        SET_STRING_ELT(output, i, STRING_ELT(addresses, i));
+      } else if(next_failed < failed.size() && failed[next_failed] == i){
+        next_failed++;
+        SET_STRING_ELT(output, i, NA_STRING);
       } else {
-        holding = parse_single(addresses[i], opt_ref);
-        std::string addr_cp = Rcpp::as<std::string>(addresses[i]);
-        if(holding[element] == NA_STRING){
-          output[i] = addresses[i];
+        write_row(i, inputs[i - start], parsed[i - start], replacement);
+      }
+    }
+  }
+
+  // Failed rows were left NA, and go round again scrubbed, with the new value
+  // set in the scrubbed address.
+  if(!failed.empty()){
+    trace_scope trace("retry", 0);
+    for(size_t n = 0; n < failed.size(); n++){
+      unsigned int i = failed[n];
+      const char* input = scrubbed_row(STRING_ELT(addresses, i), scratch->transcoded, scrubbed);
+      if(poster_parse(input, opt_ref, parsed[0]) == POSTER_STATUS_OK){
+        statuses[n] = POSTER_STATUS_RETRIED;
+        write_row(i, input, parsed[0], STRING_ELT(new_value, single_value ? 0 : i));
+      }
+    }
+  }
+  record_status(output, input_size, failed, statuses, "parsed");
+
+  memory_accounting::sample_rss();
+  return output;
+}
+
+// Whether two components are the same once folded or, if expand is set and
+// they aren't, once each is expanded as that component.
+static bool same_component(const poster_string& a, const poster_string& b, int label, bool expand,
+                           libpostal_normalize_options_t& options, poster_string& a_key, poster_string& b_key){
+  poster_fold(a, a_key);
+  poster_fold(b, b_key);
+  if(a_key == b_key){
+    return true;
+  }
+  if(!expand){
+    return false;
+  }
+  options.address_components = label_components[label];
+  return poster_expand(a.c_str(), options, a_key) && poster_expand(b.c_str(), options, b_key) &&
+    a_key == b_key;
+}
+
+// Parses a and b row by row and compares their components, returning a
+// bitmask per row of the components that agree, differ, or were found on only
+// one side. Bit n stands for the nth of parse_addr's columns.
+DataFrame poster_internal::compare_addr(CharacterVector a, CharacterVector b, bool expand){
+
+  unsigned int input_size = a.size();
+  if(b.size() != input_size){
+    Rcpp::stop("a and b must be the same length");
+  }
+  call_accounting accounting;
+  IntegerVector agree(input_size);
+  IntegerVector differ(input_size);
+  IntegerVector only_a(input_size);
+  IntegerVector only_b(input_size);
+  memory_accounting::count_r_vector(4 * input_size * sizeof(int));
+
+  libpostal_address_parser_options_t parser_options = libpostal_get_address_parser_default_options();
+  libpostal_normalize_options_t normalize_options = libpostal_get_default_options();
+  scratch_lease a_scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  scratch_lease b_scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  std::vector<const char*>& a_inputs = a_scratch->inputs;
+  std::vector<const char*>& b_inputs = b_scratch->inputs;
+  std::vector<parsed_address>& a_parsed = a_scratch->parsed;
+  std::vector<parsed_address>& b_parsed = b_scratch->parsed;
+  std::vector<unsigned int> failed;
+  std::vector<int> statuses;
+  std::vector<uint8_t> failed_sides;
+
+  // Compares row i's components, a side without an address having none.
+  auto compare_row = [&](unsigned int i, const parsed_address* a_row, const parsed_address* b_row){
+    int agreed = 0, differed = 0, a_only = 0, b_only = 0;
+    for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+      int label = column_order[n];
+      bool in_a = a_row != NULL && !a_row->components[label].empty();
+      bool in_b = b_row != NULL && !b_row->components[label].empty();
+      if(in_a && in_b){
+        if(same_component(a_row->components[label], b_row->components[label],
+                          label, expand, normalize_options, a_scratch->text, b_scratch->text)){
+          agreed |= 1 << n;
         } else {
-          addr_cp.replace(addr_cp.find(Rcpp::as<std::string>(holding[element])),
-                          Rcpp::as<std::string>(holding[element]).size(), new_value[0]);
-          output[i] = addr_cp;
+          differed |= 1 << n;
+        }
+      } else if(in_a){
+        a_only |= 1 << n;
+      } else if(in_b){
+        b_only |= 1 << n;
+      }
+    }
+    agree[i] = agreed;
+    differ[i] = differed;
+    only_a[i] = a_only;
+    only_b[i] = b_only;
+  };
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(a, start, end, *a_scratch, chunk);
+    read_chunk(b, start, end, *b_scratch, chunk);
+    size_t next_failed = failed.size();
+
+    {
+      trace_scope trace("parse", chunk);
+      for(unsigned int i = start; i < end; i++){
+        int a_status = POSTER_STATUS_OK, b_status = POSTER_STATUS_OK;
+        if(a_inputs[i - start] != NULL){
+          a_status = poster_parse(a_inputs[i - start], parser_options, a_parsed[i - start]);
+        }
+        if(b_inputs[i - start] != NULL){
+          b_status = poster_parse(b_inputs[i - start], parser_options, b_parsed[i - start]);
+        }
+        if(a_status != POSTER_STATUS_OK || b_status != POSTER_STATUS_OK){
+          failed.push_back(i);
+          statuses.push_back(a_status != POSTER_STATUS_OK ? a_status : b_status);
+          failed_sides.push_back((a_status != POSTER_STATUS_OK) | ((b_status != POSTER_STATUS_OK) << 1));
+        }
+      }
+    }
+
+    trace_scope trace("compare", chunk);
+    stage_scope scope(STAGE_CONVERT);
+    for(unsigned int i = start; i < end; i++){
+      if(next_failed < failed.size() && failed[next_failed] == i){
+        next_failed++;
+        agree[i] = differ[i] = only_a[i] = only_b[i] = NA_INTEGER;
+      } else {
+        compare_row(i, a_inputs[i - start] == NULL ? NULL : &a_parsed[i - start],
+                    b_inputs[i - start] == NULL ? NULL : &b_parsed[i - start]);
+      }
+    }
+  }
+
+  // Rows where either side failed were left NA, and go round again once
+  // every other row is done, the side that failed scrubbed.
+  if(!failed.empty()){
+    trace_scope trace("retry", 0);
+    for(size_t n = 0; n < failed.size(); n++){
+      unsigned int i = failed[n];
+      SEXP a_address = STRING_ELT(a, i), b_address = STRING_ELT(b, i);
+      bool parsed = true;
+      if(a_address != NA_STRING){
+        const char* input = (failed_sides[n] & 1) ?
+          scrubbed_row(a_address, a_scratch->transcoded, a_scratch->text) : utf8_row(a_address, a_scratch->transcoded);
+        parsed = poster_parse(input, parser_options, a_parsed[0]) == POSTER_STATUS_OK;
+      }
+      if(parsed && b_address != NA_STRING){
+        const char* input = (failed_sides[n] & 2) ?
+          scrubbed_row(b_address, b_scratch->transcoded, b_scratch->text) : utf8_row(b_address, b_scratch->transcoded);
+        parsed = poster_parse(input, parser_options, b_parsed[0]) == POSTER_STATUS_OK;
+      }
+      if(parsed){
+        statuses[n] = POSTER_STATUS_RETRIED;
+        compare_row(i, a_address == NA_STRING ? NULL : &a_parsed[0], b_address == NA_STRING ? NULL : &b_parsed[0]);
+      }
+    }
+  }
+
+  DataFrame output = DataFrame::create(_["agree"] = agree, _["differ"] = differ,
+                                       _["only_a"] = only_a, _["only_b"] = only_b);
+  record_status(output, input_size, failed, statuses, "compared");
+  memory_accounting::sample_rss();
+  return output;
+}
+
+// The template for row i of countries, which is recycled, looking it up
+// again only when the country changes.
+static const address_template* row_template(const address_formats& formats, CharacterVector& countries,
+                                            unsigned int i, SEXP& last_country, const address_template* last){
+  SEXP country = countries.size() == 0 ? NA_STRING : STRING_ELT(countries, i % countries.size());
+  if(last != NULL && country == last_country){
+    return last;
+  }
+  last_country = country;
+  return &formats.lookup(country == NA_STRING ? NULL : CHAR(country));
+}
+
+// Renders addresses from a data.frame of components, as parse_addr returns,
+// with the template for each row's country. Columns may be missing.
+CharacterVector poster_internal::format_addr(List components, CharacterVector countries,
+                                             const address_formats& formats, std::string separator){
+
+  unsigned int input_size = Rf_length(components) == 0 ? 0 : Rf_length(VECTOR_ELT(components, 0));
+  SEXP columns[PARSER_LABEL_COUNT];
+  CharacterVector names = components.names();
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    columns[n] = R_NilValue;
+  }
+  for(int column = 0; column < names.size(); column++){
+    for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+      if(strcmp(CHAR(STRING_ELT(names, column)), column_names[n]) == 0){
+        SEXP values = VECTOR_ELT(components, column);
+        if(TYPEOF(values) != STRSXP || (unsigned int) Rf_length(values) != input_size){
+          Rcpp::stop(std::string("The ") + column_names[n] + " column must be a character vector");
         }
+        columns[n] = values;
       }
     }
-  } else if(new_value.size() == input_size){
-    for(unsigned int i = 0; i < input_size; i++){
-      if((i % 10000) == 0){
-        Rcpp::checkUserInterrupt();
+  }
+
+  call_accounting accounting;
+  CharacterVector output(input_size);
+  memory_accounting::count_r_vector(input_size * sizeof(SEXP));
+  scratch_lease scratch(PARSER_LABEL_COUNT);
+  poster_string& rendered = scratch->text;
+  std::vector<poster_string>& transcoded = scratch->strings;
+  component_view view;
+  SEXP last_country = NA_STRING;
+  const address_template* format = NULL;
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    Rcpp::checkUserInterrupt();
+
+    trace_scope trace("format", chunk);
+    stage_scope scope(STAGE_WRITE);
+    for(unsigned int i = start; i < end; i++){
+      for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+        SEXP value = columns[n] == R_NilValue ? NA_STRING : STRING_ELT(columns[n], i);
+        if(value == NA_STRING){
+          view.data[n] = NULL;
+          view.size[n] = 0;
+          continue;
+        }
+        view.data[n] = utf8_row(value, transcoded[n]);
+        view.size[n] = view.data[n] == CHAR(value) ? LENGTH(value) : transcoded[n].size();
+      }
+      format = row_template(formats, countries, i, last_country, format);
+      format->render(view, separator, rendered);
+      SET_STRING_ELT(output, i, isna(rendered));
+    }
+  }
+
+  memory_accounting::sample_rss();
+  return output;
+}
+
+// Likewise, from the rows of a store.
+CharacterVector poster_internal::format_store(const parse_store& store, CharacterVector countries,
+                                              const address_formats& formats, std::string separator){
+
+  unsigned int input_size = store.size();
+  call_accounting accounting;
+  CharacterVector output(input_size);
+  memory_accounting::count_r_vector(input_size * sizeof(SEXP));
+  scratch_lease scratch(1);
+  poster_string& rendered = scratch->text;
+  std::string values[PARSER_LABEL_COUNT];
+  component_view view;
+  SEXP last_country = NA_STRING;
+  const address_template* format = NULL;
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    Rcpp::checkUserInterrupt();
+
+    trace_scope trace("format", chunk);
+    stage_scope scope(STAGE_WRITE);
+    for(unsigned int i = start; i < end; i++){
+      for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+        store.get(i, n, values[n]);
+        view.data[n] = values[n].data();
+        view.size[n] = values[n].size();
+      }
+      format = row_template(formats, countries, i, last_country, format);
+      format->render(view, separator, rendered);
+      SET_STRING_ELT(output, i, isna(rendered));
+    }
+  }
+
+  memory_accounting::sample_rss();
+  return output;
+}
+
+void poster_internal::join_keys(CharacterVector addresses, uint32_t components, bool expand,
+                                std::vector<join_key>& keys){
+
+  unsigned int input_size = addresses.size();
+  libpostal_address_parser_options_t options = libpostal_get_address_parser_default_options();
+  libpostal_normalize_options_t normalise_options = libpostal_get_default_options();
+  scratch_lease scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  std::vector<const char*>& inputs = scratch->inputs;
+  parsed_address& parsed = scratch->parsed[0];
+  poster_string& folded = scratch->text;
+  poster_string& key = scratch->strings[0];
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk);
+
+    trace_scope trace("key", chunk);
+    for(unsigned int i = start; i < end; i++){
+      if(inputs[i - start] == NULL ||
+         poster_parse(inputs[i - start], options, parsed) != POSTER_STATUS_OK){
+        continue;
+      }
+      if(expand){
+        normalise_components(parsed, components, normalise_options, folded);
+      }
+      // A key is the folded components, in column order, each ended by a
+      // unit separator; rows with none of them have no key and match nothing.
+      key.clear();
+      bool any = false;
+      for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+        int label = column_order[n];
+        if((components & (1u << label)) == 0){
+          continue;
+        }
+        poster_fold(parsed.components[label], folded);
+        any = any || !folded.empty();
+        key.append(folded);
+        key.push_back('\x1f');
+      }
+      if(any){
+        join_key row;
+        join_hash(key.data(), key.size(), row.hi, row.lo);
+        row.row = i;
+        keys.push_back(row);
+      }
+    }
+  }
+}
+
+DataFrame poster_internal::join_addr(CharacterVector x, CharacterVector y, uint32_t components, bool expand){
+
+  if(components == 0){
+    Rcpp::stop("At least one component is needed to join on");
+  }
+  call_accounting accounting;
+
+  // Both sides' keys, the copy partitioning makes of the larger and the
+  // count of each x row's pairs are held in memory granted by the resource
+  // governor.
+  size_t bytes = (x.size() + y.size()) * sizeof(join_key) + radix_join_bytes(x.size(), y.size());
+  memory_grant keys_memory(bytes);
+  if(keys_memory.bytes() < bytes){
+    Rcpp::stop("Joining needs " + std::to_string(bytes) + " bytes, but the resource governor has only " +
+               std::to_string(keys_memory.bytes()) + " to spare; see set_resources()");
+  }
+  std::vector<join_key> x_keys, y_keys;
+  x_keys.reserve(x.size());
+  y_keys.reserve(y.size());
+  join_keys(x, components, expand, x_keys);
+  join_keys(y, components, expand, y_keys);
+
+  // Partitioning and probing don't touch libpostal, so they can use as many
+  // threads as the governor grants, besides this one. The pairs found are
+  // granted too, once they have been counted.
+  unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+  memory_grant pairs_memory(0);
+  std::vector<uint64_t> pairs;
+  size_t found;
+  {
+    thread_grant extra(hardware - 1);
+    trace_scope trace("join", 0);
+    found = radix_join(x_keys, y_keys, extra.threads() + 1, pairs_memory, pairs);
+  }
+  std::vector<join_key>().swap(x_keys);
+  std::vector<join_key>().swap(y_keys);
+  if(pairs.size() < found){
+    Rcpp::stop("Joining finds " + std::to_string(found) + " pairs, needing " +
+               std::to_string(found * sizeof(uint64_t)) + " bytes, but the resource governor hasn't that to " +
+               "spare; see set_resources()");
+  }
+
+  IntegerVector x_rows(pairs.size());
+  IntegerVector y_rows(pairs.size());
+  memory_accounting::count_r_vector(2 * pairs.size() * sizeof(int));
+  for(size_t i = 0; i < pairs.size(); i++){
+    x_rows[i] = (pairs[i] >> 32) + 1;
+    y_rows[i] = (pairs[i] & 0xffffffffULL) + 1;
+  }
+  memory_accounting::sample_rss();
+  return DataFrame::create(_["x"] = x_rows, _["y"] = y_rows);
+}
+
+void poster_internal::link_keys(CharacterVector addresses, const std::vector<std::vector<int> >& keys, bool expand,
+                                std::vector<key_column>& columns){
+
+  unsigned int input_size = addresses.size();
+  libpostal_address_parser_options_t options = libpostal_get_address_parser_default_options();
+  libpostal_normalize_options_t normalise_options = libpostal_get_default_options();
+  scratch_lease scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  std::vector<const char*>& inputs = scratch->inputs;
+  parsed_address& parsed = scratch->parsed[0];
+  poster_string& folded = scratch->text;
+  poster_string& key = scratch->strings[0];
+  poster_string empty;
+  uint32_t components = 0;
+  for(unsigned int pass = 0; pass < keys.size(); pass++){
+    for(unsigned int n = 0; n < keys[pass].size(); n++){
+      components |= 1u << keys[pass][n];
+    }
+  }
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk);
+
+    trace_scope trace("key", chunk);
+    for(unsigned int i = start; i < end; i++){
+      // Each address is parsed once, for every pass's key.
+      if(inputs[i - start] == NULL ||
+         poster_parse(inputs[i - start], options, parsed) != POSTER_STATUS_OK){
+        for(unsigned int pass = 0; pass < keys.size(); pass++){
+          columns[pass].add(empty);
+        }
+        continue;
+      }
+      if(expand){
+        normalise_components(parsed, components, normalise_options, folded);
+      }
+      for(unsigned int pass = 0; pass < keys.size(); pass++){
+        key.clear();
+        bool any = false;
+        for(unsigned int n = 0; n < keys[pass].size(); n++){
+          poster_fold(parsed.components[keys[pass][n]], folded);
+          any = any || !folded.empty();
+          key.append(folded);
+          key.push_back('\x1f');
+        }
+        columns[pass].add(any ? key : empty);
+      }
+    }
+  }
+}
+
+// Hands callback a batch of pairs, as a data.frame.
+static void emit_pairs(Function& callback, const std::vector<uint32_t>& first, const std::vector<uint32_t>& second,
+                       int pass){
+  size_t rows = first.size();
+  IntegerVector x_rows(rows), y_rows(rows), passes(rows, pass);
+  for(size_t i = 0; i < rows; i++){
+    x_rows[i] = first[i] + 1;
+    y_rows[i] = second[i] + 1;
+  }
+  callback(DataFrame::create(_["x"] = x_rows, _["y"] = y_rows, _["pass"] = passes));
+}
+
+SEXP poster_internal::link_addr(CharacterVector x, CharacterVector y, bool single,
+                                const std::vector<std::vector<int> >& keys, bool expand,
+                                unsigned int window, size_t batch_size, SEXP callback){
+
+  if(keys.empty()){
+    Rcpp::stop("At least one key is needed to link on");
+  }
+  for(unsigned int pass = 0; pass < keys.size(); pass++){
+    if(keys[pass].empty()){
+      Rcpp::stop("Each key needs at least one component");
+    }
+  }
+  if(window < 2){
+    Rcpp::stop("window must be at least 2");
+  }
+  if(batch_size < 1){
+    Rcpp::stop("batch_size must be at least 1");
+  }
+  size_t x_size = x.size(), rows = x_size + (single ? 0 : y.size());
+  if(rows >= UINT32_MAX){
+    Rcpp::stop("Linkage is limited to " + std::to_string(UINT32_MAX - 1) + " addresses");
+  }
+  call_accounting accounting;
+
+  // Each pass's ranks, and the order and sort space of the one running, are
+  // held in memory granted by the resource governor, as are the keys, at an
+  // offset a row and a pass besides their text.
+  size_t bytes = rows * keys.size() * (sizeof(uint32_t) + sizeof(uint64_t)) +
+    rows * sizeof(uint32_t) + sort_keys_bytes(rows);
+  memory_grant link_memory(bytes);
+  if(link_memory.bytes() < bytes){
+    Rcpp::stop("Linking needs " + std::to_string(bytes) + " bytes, but the resource governor has only " +
+               std::to_string(link_memory.bytes()) + " to spare; see set_resources()");
+  }
+  std::vector<key_column> columns(keys.size());
+  link_keys(x, keys, expand, columns);
+  if(!single){
+    link_keys(y, keys, expand, columns);
+  }
+
+  bool streaming = !Rf_isNull(callback);
+  std::unique_ptr<Function> handler(streaming ? new Function(callback) : NULL);
+  sorted_neighbourhood neighbourhood(rows, single ? rows : x_size, window);
+  std::vector<uint32_t> first, second, all_first, all_second;
+  std::vector<int> all_passes;
+  double found = 0;
+  unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+
+  for(unsigned int pass = 0; pass < keys.size(); pass++){
+
+    // Sorting doesn't touch libpostal, so it can use as many threads as the
+    // governor grants, besides this one.
+    {
+      thread_grant extra(hardware - 1);
+      trace_scope trace("sort", pass);
+      neighbourhood.start_pass(columns[pass], extra.threads() + 1);
+    }
+
+    size_t batch = 0;
+    do {
+      Rcpp::checkUserInterrupt();
+      first.clear();
+      second.clear();
+      {
+        trace_scope trace("window", pass);
+        batch = neighbourhood.next_pairs(batch_size, first, second);
+      }
+      found += batch;
+      if(batch == 0){
+        break;
       }
-      
-      if(addresses[i] == NA_STRING){
-        output[i] = NA_STRING;
-      } else if(new_value[i] == NA_STRING){
-        output[i] = addresses[i];
+      if(streaming){
+        emit_pairs(*handler, first, second, pass + 1);
       } else {
-        holding = parse_single(addresses[i], opt_ref);
-        std::string addr_cp = Rcpp::as<std::string>(addresses[i]);
-        if(holding[element] == NA_STRING){
-          output[i] = addresses[i];
+        all_first.insert(all_first.end(), first.begin(), first.end());
+        all_second.insert(all_second.end(), second.begin(), second.end());
+        all_passes.insert(all_passes.end(), batch, pass + 1);
+      }
+    } while(batch == batch_size);
+  }
+
+  memory_accounting::sample_rss();
+  if(streaming){
+    return Rcpp::wrap(found);
+  }
+  IntegerVector x_rows(all_first.size()), y_rows(all_first.size());
+  memory_accounting::count_r_vector(3 * all_first.size() * sizeof(int));
+  for(size_t i = 0; i < all_first.size(); i++){
+    x_rows[i] = all_first[i] + 1;
+    y_rows[i] = all_second[i] + 1;
+  }
+  IntegerVector passes(all_passes.begin(), all_passes.end());
+  return DataFrame::create(_["x"] = x_rows, _["y"] = y_rows, _["pass"] = passes);
+}
+
+// The fastest of reps runs of each row through the parser or normaliser, in
+// nanoseconds. Taking the minimum keeps scheduling noise out of the baseline.
+NumericVector poster_internal::time_rows(CharacterVector addresses, int mode, int reps, bool sanitise,
+                                         uint32_t normalise){
+
+  if(mode != POSTER_MODE_PARSE && mode != POSTER_MODE_NORMALISE){
+    Rcpp::stop("mode must be parse or normalise");
+  }
+  if(reps < 1){
+    Rcpp::stop("reps must be at least 1");
+  }
+  unsigned int input_size = addresses.size();
+  NumericVector output(input_size, NA_REAL);
+  libpostal_address_parser_options_t parser_options = libpostal_get_address_parser_default_options();
+  libpostal_normalize_options_t normalize_options = libpostal_get_default_options();
+  libpostal_normalize_options_t component_options = libpostal_get_default_options();
+  scratch_lease scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  std::vector<const char*>& inputs = scratch->inputs;
+  parsed_address& parsed = scratch->parsed[0];
+  poster_string& expanded = scratch->text;
+  poster_string& sanitised = scratch->strings[0];
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk);
+
+    for(unsigned int i = start; i < end; i++){
+      if(inputs[i - start] == NULL){
+        continue;
+      }
+      double fastest = -1;
+      for(int rep = 0; rep < reps; rep++){
+        std::chrono::steady_clock::time_point began = std::chrono::steady_clock::now();
+        const char* input = inputs[i - start];
+        if(sanitise && poster_sanitise(input, strlen(input), sanitised)){
+          input = sanitised.c_str();
+        }
+        if(mode == POSTER_MODE_PARSE){
+          if(poster_parse(input, parser_options, parsed) == POSTER_STATUS_OK && normalise != 0){
+            normalise_components(parsed, normalise, component_options, expanded);
+          }
         } else {
-          addr_cp.replace(addr_cp.find(Rcpp::as<std::string>(holding[element])),
-                          Rcpp::as<std::string>(holding[element]).size(), new_value[i]);
-          output[i] = addr_cp;
+          poster_expand(input, normalize_options, expanded);
+        }
+        double elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - began).count();
+        if(fastest < 0 || elapsed < fastest){
+          fastest = elapsed;
         }
       }
+      output[i] = fastest;
     }
-  } else {
-    Rcpp::stop("The set of new values must be the same length as the addresses, or of length 1");
   }
-  
+
   return output;
 }
+
+// What plan_engine looks at: how many rows it scans for repeats (which is
+// cheap enough to do on far more rows than it times), samples for their
+// lengths, and times.
+#define POSTER_PLAN_SCAN 1000000
+#define POSTER_PLAN_SAMPLE 2000
+#define POSTER_PLAN_TIMED 200
+
+// What it aims for: chunks that take about a quarter of a second, so that
+// interrupts are seen promptly, within a cap on their scratch space, and a
+// table of rows seen that fits in its own cap and what the resource governor
+// has left. A string R holds takes about POSTER_PLAN_CHARSXP_BYTES beyond its
+// text.
+#define POSTER_PLAN_CHUNK_SECONDS 0.25
+#define POSTER_PLAN_CHUNK_BYTES (16 << 20)
+#define POSTER_PLAN_MIN_CHUNK 1000
+#define POSTER_PLAN_MAX_CHUNK 100000
+#define POSTER_PLAN_CACHE_BYTES (256 << 20)
+#define POSTER_PLAN_CHARSXP_BYTES 56
+
+const char* poster_internal::prepared_row(SEXP address, bool sanitise, poster_string& transcoded,
+                                          poster_string& output){
+  const char* input = utf8_row(address, transcoded);
+  if(sanitise && poster_sanitise(input, strlen(input), output)){
+    return output.c_str();
+  }
+  return input;
+}
+
+engine_plan poster_internal::plan_engine(CharacterVector addresses, int mode, bool sanitise, uint32_t normalise){
+
+  if(mode != POSTER_MODE_PARSE && mode != POSTER_MODE_NORMALISE){
+    Rcpp::stop("mode must be parse or normalise");
+  }
+  size_t input_size = addresses.size();
+  engine_plan plan;
+  plan.planned = true;
+
+  // How often rows repeat, and what it costs to look one up. Sanitised rows
+  // repeat when their text does, as find_repeats looks them up; sanitising
+  // is timed on its own, and left out of the lookups, since a call does it
+  // whether or not it looks for repeats.
+  memory_grant scan(std::min(input_size, (size_t) POSTER_PLAN_SCAN) * POSTER_PLAN_ENTRY_BYTES);
+  plan.scanned = scan.bytes() / POSTER_PLAN_ENTRY_BYTES;
+  scratch_lease scratch(1);
+  std::unordered_set<SEXP> distinct;
+  std::unordered_set<std::string> distinct_text;
+  size_t present = 0;
+  std::chrono::steady_clock::time_point began = std::chrono::steady_clock::now();
+  if(sanitise){
+    for(size_t i = 0; i < plan.scanned; i++){
+      SEXP address = STRING_ELT(addresses, i);
+      if(address != NA_STRING){
+        distinct_text.insert(prepared_row(address, true, scratch->transcoded, scratch->text));
+        present++;
+      }
+    }
+  } else {
+    distinct.reserve(plan.scanned);
+    for(size_t i = 0; i < plan.scanned; i++){
+      SEXP address = STRING_ELT(addresses, i);
+      if(address != NA_STRING){
+        distinct.insert(address);
+        present++;
+      }
+    }
+  }
+  double scan_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+  if(sanitise){
+    began = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < plan.scanned; i++){
+      SEXP address = STRING_ELT(addresses, i);
+      if(address != NA_STRING){
+        prepared_row(address, true, scratch->transcoded, scratch->text);
+      }
+    }
+    scan_seconds = std::max(0.0, scan_seconds - std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count());
+  }
+  if(present > 0){
+    plan.duplicate_rate = 1 - (double) (sanitise ? distinct_text.size() : distinct.size()) / present;
+    plan.lookup_seconds = scan_seconds / present;
+  }
+  std::unordered_set<std::string>().swap(distinct_text);
+
+  // How long rows are, from rows spread evenly through the input.
+  std::vector<SEXP> rows;
+  std::vector<size_t> lengths;
+  size_t stride = std::max((size_t) 1, input_size / POSTER_PLAN_SAMPLE);
+  for(size_t i = 0; i < input_size && rows.size() < POSTER_PLAN_SAMPLE; i += stride){
+    SEXP address = STRING_ELT(addresses, i);
+    if(address != NA_STRING){
+      rows.push_back(address);
+      lengths.push_back(LENGTH(address));
+    }
+  }
+  plan.sampled = rows.size();
+  if(plan.sampled == 0){
+    plan.chunk_size = std::max((size_t) 1, std::min(input_size, (size_t) POSTER_CHUNK_SIZE));
+    return plan;
+  }
+  double total_bytes = 0;
+  for(size_t n = 0; n < lengths.size(); n++){
+    total_bytes += lengths[n];
+  }
+  plan.mean_bytes = total_bytes / lengths.size();
+  std::vector<size_t>::iterator p95 = lengths.begin() + (lengths.size() * 95) / 100;
+  std::nth_element(lengths.begin(), p95, lengths.end());
+  plan.p95_bytes = *p95;
+
+  // What a row costs to run, prepared as the call will, and how much of the
+  // output it takes up.
+  libpostal_address_parser_options_t parser_options = libpostal_get_address_parser_default_options();
+  libpostal_normalize_options_t normalize_options = libpostal_get_default_options();
+  libpostal_normalize_options_t component_options = libpostal_get_default_options();
+  parsed_address& parsed = scratch->parsed[0];
+  poster_string& expanded = scratch->strings[0];
+  plan.timed = std::min(rows.size(), (size_t) POSTER_PLAN_TIMED);
+  double output_bytes = 0;
+  began = std::chrono::steady_clock::now();
+  for(size_t n = 0; n < plan.timed; n++){
+    const char* row = prepared_row(rows[n], sanitise, scratch->transcoded, scratch->text);
+    if(mode == POSTER_MODE_PARSE){
+      if(poster_parse(row, parser_options, parsed) == POSTER_STATUS_OK && normalise != 0){
+        normalise_components(parsed, normalise, component_options, expanded);
+      }
+      for(unsigned int label = 0; label < PARSER_LABEL_COUNT; label++){
+        if(!parsed.components[label].empty()){
+          output_bytes += parsed.components[label].size() + POSTER_PLAN_CHARSXP_BYTES;
+        }
+      }
+    } else {
+      poster_expand(row, normalize_options, expanded);
+      output_bytes += expanded.size() + POSTER_PLAN_CHARSXP_BYTES;
+    }
+  }
+  plan.row_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count() / plan.timed;
+  double scratch_bytes = sizeof(const char*) + plan.mean_bytes +
+    (mode == POSTER_MODE_PARSE ? sizeof(parsed_address) : sizeof(poster_string));
+  double column_bytes = (mode == POSTER_MODE_PARSE ? PARSER_LABEL_COUNT : 1) * sizeof(SEXP);
+  plan.bytes_per_row = scratch_bytes + column_bytes + output_bytes / plan.timed;
+
+  // Repeats are worth finding if the runs they save outweigh the lookups.
+  plan.dedup = plan.duplicate_rate * plan.row_seconds > plan.lookup_seconds;
+  if(plan.dedup){
+    double expected = std::ceil((1 - plan.duplicate_rate) * input_size);
+    size_t limit = resource_governor::memory_limit();
+    size_t used = std::min(limit, resource_governor::memory_used());
+    double room = std::min((double) POSTER_PLAN_CACHE_BYTES, (double) (limit - used));
+    plan.cache_entries = (size_t) std::min(expected, room / POSTER_PLAN_ENTRY_BYTES);
+    plan.dedup = plan.cache_entries > 0;
+  }
+
+  double chunk = plan.row_seconds > 0 ? POSTER_PLAN_CHUNK_SECONDS / plan.row_seconds : POSTER_PLAN_MAX_CHUNK;
+  chunk = std::min(chunk, POSTER_PLAN_CHUNK_BYTES / scratch_bytes);
+  chunk = std::max((double) POSTER_PLAN_MIN_CHUNK, std::min((double) POSTER_PLAN_MAX_CHUNK, chunk));
+  plan.chunk_size = (unsigned int) std::max((size_t) 1, std::min(input_size, (size_t) chunk));
+
+  double seconds = plan.dedup ? (1 - plan.duplicate_rate) * plan.row_seconds + plan.lookup_seconds : plan.row_seconds;
+  plan.rows_per_second = seconds > 0 ? 1 / seconds : R_PosInf;
+  return plan;
+}
+
+List poster_internal::plan_info(const engine_plan& plan){
+  return List::create(_["threads"] = (int) plan.threads,
+                      _["chunk_size"] = (int) plan.chunk_size,
+                      _["dedup"] = plan.dedup,
+                      _["cache_entries"] = (double) plan.cache_entries,
+                      _["rows_per_second"] = plan.rows_per_second,
+                      _["scanned"] = (double) plan.scanned,
+                      _["sampled"] = (double) plan.sampled,
+                      _["timed"] = (double) plan.timed,
+                      _["duplicate_rate"] = plan.duplicate_rate,
+                      _["mean_bytes"] = plan.mean_bytes,
+                      _["p95_bytes"] = plan.p95_bytes,
+                      _["row_seconds"] = plan.row_seconds,
+                      _["lookup_seconds"] = plan.lookup_seconds,
+                      _["bytes_per_row"] = plan.bytes_per_row);
+}
+
+parse_store* poster_internal::build_store(CharacterVector addresses, size_t memory_limit, std::string spill_dir,
+                                          std::vector<unsigned int>& failed, std::vector<int>& statuses){
+
+  unsigned int input_size = addresses.size();
+  libpostal_address_parser_options_t options = libpostal_get_address_parser_default_options();
+  scratch_lease scratch(chunk_rows(input_size, POSTER_CHUNK_SIZE));
+  std::vector<const char*>& inputs = scratch->inputs;
+  parsed_address& parsed = scratch->parsed[0];
+  // The rows' codes are held in memory drawn from the resource governor,
+  // and spilled beyond what it grants - though never in batches of less than
+  // a chunk's rows, unless memory_limit itself is smaller, so that a governor
+  // with little left slows the build down rather than spilling row by row.
+  size_t wanted = memory_limit > 0 ? memory_limit : resource_governor::memory_limit();
+  memory_grant codes(wanted == SIZE_MAX ? 0 : wanted);
+  size_t least = std::min(wanted, (size_t) POSTER_CHUNK_SIZE * PARSER_LABEL_COUNT * sizeof(uint32_t));
+  parse_store::builder builder(wanted == SIZE_MAX ? 0 : std::max(least, codes.bytes()), spill_dir);
+
+  for(unsigned int start = 0; start < input_size; start += POSTER_CHUNK_SIZE){
+
+    unsigned int end = std::min(input_size, start + POSTER_CHUNK_SIZE);
+    int64_t chunk = start / POSTER_CHUNK_SIZE;
+    chunk_scope chunk_marker(chunk, end - start);
+    read_chunk(addresses, start, end, *scratch, chunk);
+
+    trace_scope trace("parse", chunk);
+    for(unsigned int i = start; i < end; i++){
+      if(inputs[i - start] == NULL){
+        builder.add_missing();
+        continue;
+      }
+      // Rows are added in order, so a row that fails is retried there and
+      // then, scrubbed, and added as missing if it fails again.
+      int status = poster_parse(inputs[i - start], options, parsed);
+      if(status != POSTER_STATUS_OK){
+        poster_scrub(inputs[i - start], scratch->text);
+        failed.push_back(i);
+        statuses.push_back(poster_parse(scratch->text.c_str(), options, parsed) == POSTER_STATUS_OK ?
+                           (int) POSTER_STATUS_RETRIED : status);
+        if(statuses.back() != POSTER_STATUS_RETRIED){
+          builder.add_missing();
+          continue;
+        }
+      }
+      builder.add(parsed);
+    }
+  }
+
+  std::unique_ptr<parse_store> store(new parse_store());
+  builder.finish(*store);
+  return store.release();
+}
+
+DataFrame poster_internal::store_rows(const parse_store& store, IntegerVector rows){
+
+  unsigned int output_size = rows.size();
+  SEXP columns[PARSER_LABEL_COUNT];
+  List output = component_frame(output_size, columns);
+  std::string value;
+
+  for(unsigned int i = 0; i < output_size; i++){
+    if((i % POSTER_CHUNK_SIZE) == 0){
+      Rcpp::checkUserInterrupt();
+    }
+    if(rows[i] == NA_INTEGER || rows[i] < 1 || (size_t) rows[i] > store.size()){
+      continue;
+    }
+    for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+      if(store.get(rows[i] - 1, n, value)){
+        SET_STRING_ELT(columns[n], i, Rf_mkCharLenCE(value.data(), value.size(), CE_UTF8));
+      }
+    }
+  }
+
+  return DataFrame(output);
+}
+
+List poster_internal::store_info(const parse_store& store){
+  NumericVector distinct(PARSER_LABEL_COUNT);
+  CharacterVector names(PARSER_LABEL_COUNT);
+  for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+    distinct[n] = store.distinct(column_order[n]);
+    names[n] = column_names[column_order[n]];
+  }
+  distinct.attr("names") = names;
+  return List::create(_["rows"] = (double) store.size(),
+                      _["bytes"] = (double) store.bytes(),
+                      _["spilled_bytes"] = (double) store.spilled(),
+                      _["distinct"] = distinct);
+}
@@ -1,29 +1,216 @@
 #include <Rcpp.h>
-#include <libpostal/libpostal.h>
+#include "buffer_pool.h"
+#include "formatter.h"
+#include "join.h"
+#include "linkage.h"
+#include "parse_store.h"
+#include "string_column.h"
+#include <climits>
+#include <unordered_map>
+#include <vector>
 using namespace Rcpp;
 
 
 #ifndef __POSTER_INTERNAL__
 #define __POSTER_INTERNAL__
 
+// Rows are read, parsed and converted a chunk at a time, checking for
+// interrupts between chunks.
+#define POSTER_CHUNK_SIZE 10000
+
+// How parse_addr and normalise_addr run a call: how many rows go in a chunk,
+// and whether a row that repeats an earlier one is copied from it rather than
+// run again, remembering up to cache_entries distinct rows to find repeats
+// among. Every call to libpostal holds libpostal_mutex, so a call runs on one
+// thread whatever the plan.
+//
+// A plan made by plan_engine also has what it was chosen from: how many rows
+// it sampled and timed, what it measured in them, and the throughput it
+// expects of the plan.
+struct engine_plan {
+  unsigned int chunk_size;
+  bool dedup;
+  size_t cache_entries;
+  unsigned int threads;
+  bool planned;
+  size_t scanned;
+  size_t sampled;
+  size_t timed;
+  double duplicate_rate;
+  double mean_bytes;
+  double p95_bytes;
+  double row_seconds;
+  double lookup_seconds;
+  double bytes_per_row;
+  double rows_per_second;
+  engine_plan() : chunk_size(POSTER_CHUNK_SIZE), dedup(false), cache_entries(0), threads(1),
+                  planned(false), scanned(0), sampled(0), timed(0), duplicate_rate(0),
+                  mean_bytes(0), p95_bytes(0), row_seconds(0), lookup_seconds(0),
+                  bytes_per_row(0), rows_per_second(0) {}
+};
+
+// The rows of a call seen so far, for finding rows that repeat an earlier
+// one. R keeps one copy of each distinct string, so rows are told apart by
+// their CHARSXP - unless they are sanitised first, when different strings
+// can become the same text, and they are told apart by that instead. It
+// holds no more than budget bytes of entries.
+struct repeat_table {
+  bool by_text;
+  size_t budget;
+  size_t used;
+  std::unordered_map<SEXP, unsigned int> rows;
+  std::unordered_map<std::string, unsigned int> texts;
+  std::string key;
+  repeat_table(bool by_text, size_t budget) : by_text(by_text), budget(budget), used(0) {}
+};
+
+// Marks a chunk in traces and for the chunk_start and chunk_end probes.
+class chunk_scope {
+
+private:
+
+  trace_scope trace;
+  int64_t chunk;
+
+public:
+
+  chunk_scope(int64_t chunk, unsigned int rows) : trace("chunk", chunk), chunk(chunk) {
+    POSTER_PROBE2(chunk_start, chunk, rows);
+  }
+
+  ~chunk_scope(){
+    POSTER_PROBE1(chunk_end, chunk);
+  }
+
+};
+
 class poster_internal {
-  
+
 private:
-  
-  String isna(std::string x);
-  
-  CharacterVector parse_single(String x, address_parser_options_t& opts);
-  
+
+  static const char* column_names[PARSER_LABEL_COUNT];
+
+  static const int column_order[PARSER_LABEL_COUNT];
+
+  SEXP isna(const poster_string& x);
+
+  // A data.frame of parse_addr's columns, pointing columns at them by label;
+  // if lazy, its columns are left NULL for string columns to fill.
+  List component_frame(unsigned int rows, SEXP* columns, bool lazy = false);
+
+  // Points scratch's inputs at a chunk of addresses, or NULL for NAs. Rows
+  // that aren't UTF-8 are transcoded into scratch's arena and pointed to
+  // there. With sanitise, rows are then sanitised into scratch's sanitised
+  // strings, and those that change are pointed to there instead.
+  void read_chunk(CharacterVector& addresses, unsigned int start, unsigned int end,
+                  scratch_buffers& scratch, int64_t chunk, bool sanitise = false);
+
+  // A row of addresses as UTF-8, transcoded into buffer if it isn't already.
+  const char* utf8_row(SEXP address, poster_string& buffer);
+
+  // Appends the key of each row of addresses that has any of the components
+  // whose labels are in the components bitmask, expanding them first with
+  // expand, to keys.
+  void join_keys(CharacterVector addresses, uint32_t components, bool expand, std::vector<join_key>& keys);
+
+  // Appends to each of columns the key each row of addresses has for the
+  // matching entry of keys: those labels' components, folded (and expanded
+  // first, with expand) and in that order, or none if it has none of them.
+  void link_keys(CharacterVector addresses, const std::vector<std::vector<int> >& keys, bool expand,
+                 std::vector<key_column>& columns);
+
+  void write_components(SEXP* columns, unsigned int row, const parsed_address& parsed);
+
+  normalize_options_t retry_options();
+
+  // A row that failed as it is retried: as UTF-8, scrubbed into output of
+  // what isn't valid UTF-8 and of control characters.
+  const char* scrubbed_row(SEXP address, poster_string& transcoded, poster_string& output);
+
+  // A row as a call runs it: as UTF-8 and, with sanitise, sanitised into
+  // output if that changes it.
+  const char* prepared_row(SEXP address, bool sanitise, poster_string& transcoded, poster_string& output);
+
+  // Finds which rows of a chunk, read into inputs, repeat an earlier row of
+  // the call, noting each one's earlier row in repeats (or NO_REPEAT), and
+  // remembering rows that don't in seen while it has room for them.
+  void find_repeats(CharacterVector& addresses, const std::vector<const char*>& inputs, unsigned int start,
+                    unsigned int end, repeat_table& seen, std::vector<unsigned int>& repeats);
+
 public:
-  
-  CharacterVector address_normalise(CharacterVector addresses);
-  
-  DataFrame parse_addr(CharacterVector addresses);
-  
+
+  static const unsigned int NO_REPEAT = UINT_MAX;
+
+  CharacterVector address_normalise(CharacterVector addresses, bool sanitise,
+                                    const engine_plan& plan = engine_plan());
+
+  // The labels of parse_addr's columns named in columns, in that order, or
+  // as a bitmask.
+  std::vector<int> label_list(CharacterVector columns);
+  uint32_t label_mask(CharacterVector columns);
+
+  // Parses addresses, normalising the components whose labels are in the
+  // normalise bitmask as each row is parsed. If lazy, components are kept in
+  // string heaps, and the columns are string columns over them.
+  DataFrame parse_addr(CharacterVector addresses, bool sanitise, const engine_plan& plan = engine_plan(),
+                       uint32_t normalise = 0, bool lazy = false);
+
+  // Samples addresses to choose a plan for running them in mode, prepared
+  // and normalised as the call will: transcoded, sanitised if sanitise is
+  // set, and with the components in the normalise bitmask normalised.
+  engine_plan plan_engine(CharacterVector addresses, int mode, bool sanitise = false, uint32_t normalise = 0);
+
+  List plan_info(const engine_plan& plan);
+
+  CharacterVector sanitise_addr(CharacterVector addresses);
+
   CharacterVector get_elements(CharacterVector addresses, int element);
-  
-  CharacterVector set_elements(CharacterVector addresses, CharacterVector new_value, int element);
-  
+
+  CharacterVector set_elements(CharacterVector addresses, CharacterVector new_value, int element,
+                               std::string country);
+
+  List parse_tokens(CharacterVector addresses);
+
+  DataFrame compare_addr(CharacterVector a, CharacterVector b, bool expand);
+
+  // The rows of x and y whose components in the components bitmask are
+  // equal, once folded (and expanded, with expand), as 1-based pairs.
+  DataFrame join_addr(CharacterVector x, CharacterVector y, uint32_t components, bool expand);
+
+  // Candidate pairs of rows of x and y (or, if single, of x alone) from a
+  // sorted-neighbourhood pass over each of keys, as 1-based pairs and the
+  // pass that found them. Pairs are handed to callback batch_size at a time,
+  // returning how many there were, or all returned at once if it is NULL.
+  SEXP link_addr(CharacterVector x, CharacterVector y, bool single, const std::vector<std::vector<int> >& keys,
+                 bool expand, unsigned int window, size_t batch_size, SEXP callback);
+
+  CharacterVector format_addr(List components, CharacterVector countries, const address_formats& formats,
+                              std::string separator);
+
+  CharacterVector format_store(const parse_store& store, CharacterVector countries,
+                               const address_formats& formats, std::string separator);
+
+  // Builds a store of addresses, noting the rows that failed, each retried as
+  // it fails, in failed and what became of them in statuses.
+  parse_store* build_store(CharacterVector addresses, size_t memory_limit, std::string spill_dir,
+                           std::vector<unsigned int>& failed, std::vector<int>& statuses);
+
+  // Marks output with each row's POSTER_STATUS_, as a factor in its "status"
+  // attribute, if any rows in failed weren't run, counting them and warning
+  // of any still failing after their retry.
+  void record_status(SEXP output, unsigned int rows, const std::vector<unsigned int>& failed,
+                     const std::vector<int>& statuses, const char* verb);
+
+  DataFrame store_rows(const parse_store& store, IntegerVector rows);
+
+  List store_info(const parse_store& store);
+
+  // The fastest of reps runs of each row of addresses in mode, in
+  // nanoseconds: sanitised first with sanitise and, parsing, with the
+  // components in the normalise bitmask normalised.
+  NumericVector time_rows(CharacterVector addresses, int mode, int reps, bool sanitise = false,
+                          uint32_t normalise = 0);
+
 };
 
 #endif
@@ -1,17 +1,92 @@
+#include <chrono>
+#include <thread>
 #include "postal.h"
+#include "governor.h"
+#include "metrics.h"
+#include "model_worker.h"
+
+// The process's parsing service, if one has been started.
+static parse_service service;
+
+// Exports metrics, if asked to.
+static metrics_exporter exporter;
+
+// The gauges read whenever metrics are scraped.
+static void service_gauges(std::vector<metrics_gauge>& gauges){
+  metrics_gauge gauge;
+  gauge.name = "poster_service_up";
+  gauge.help = "Whether the parsing service is running.";
+  gauge.value = service.is_running();
+  gauges.push_back(gauge);
+
+  gauge.name = "poster_queue_depth";
+  gauge.help = "Requests waiting for a response, by lane.";
+  for(unsigned int lane = 0; lane < LANE_COUNT; lane++){
+    gauge.labels = std::string("lane=\"") + lane_names[lane] + "\"";
+    gauge.value = service.waiting[lane];
+    gauges.push_back(gauge);
+  }
+
+  gauge.name = "poster_model_version";
+  gauge.help = "The number of times libpostal's models have been reloaded.";
+  gauge.labels.clear();
+  gauge.value = model_version;
+  gauges.push_back(gauge);
+
+  gauge.name = "poster_governed_threads";
+  gauge.help = "Worker threads granted by the resource governor.";
+  gauge.value = resource_governor::threads_used();
+  gauges.push_back(gauge);
+
+  gauge.name = "poster_governed_memory_bytes";
+  gauge.help = "Native memory granted by the resource governor.";
+  gauge.value = resource_governor::memory_used();
+  gauges.push_back(gauge);
+
+  gauge.name = "poster_resident_memory_bytes";
+  gauge.help = "Resident memory, most of which is libpostal's models, by process.";
+  gauge.labels = "process=\"poster\"";
+  gauge.value = memory_accounting::read_rss();
+  gauges.push_back(gauge);
+  long worker = service.model_worker_pid();
+  if(worker > 0){
+    gauge.labels = "process=\"model_worker\"";
+    gauge.value = memory_accounting::read_rss(worker);
+    gauges.push_back(gauge);
+  }
+}
 
 // Consistently set up and end usage.
 //[[Rcpp::export]]
 void setup() {
-  if (!libpostal_setup() || !libpostal_setup_language_classifier() || !libpostal_setup_parser()) {
+  POSTER_PROBE(setup_start);
+  if (!poster_setup("")) {
+    POSTER_PROBE1(setup_end, 0);
     throw std::runtime_error("Libbpostal setup failed");
   }
+  metrics::set_gauges(service_gauges);
+  POSTER_PROBE1(setup_end, 1);
 }
 //[[Rcpp::export]]
 void end() {
-  libpostal_teardown();
-  libpostal_teardown_language_classifier();
-  libpostal_teardown_parser();
+  POSTER_PROBE(teardown_start);
+  exporter.stop();
+  service.stop();
+  poster_teardown();
+  POSTER_PROBE(teardown_end);
+}
+
+// The plan a call asked for: a fixed one, or one chosen from its addresses
+// as the call will run them.
+static engine_plan choose_plan(poster_internal& pinst, CharacterVector addresses, const std::string& plan,
+                               int mode, bool sanitise, uint32_t normalise = 0){
+  if(plan == "auto"){
+    return pinst.plan_engine(addresses, mode, sanitise, normalise);
+  }
+  if(plan != "none"){
+    Rcpp::stop("plan must be \"none\" or \"auto\"");
+  }
+  return engine_plan();
 }
 
 //'@title Normalise postal addresses
@@ -21,6 +96,16 @@ void end() {
 //'
 //'@param addresses a character vector of addresses to normalise
 //'
+//'@param sanitise whether to clean addresses up before normalising them, so
+//'that addresses that differ only in their whitespace, invisible characters
+//'or Unicode normalisation form come out the same. See \code{\link{sanitise_addr}}.
+//'
+//'@param plan how to run the call. \code{"none"} runs every row in chunks of
+//'a fixed size. \code{"auto"} samples the addresses first, as
+//'\code{\link{plan_addr}} does, and chooses the chunk size and whether rows
+//'that repeat earlier ones are copied rather than run again; the plan it
+//'chose is in the output's \code{"plan"} attribute.
+//'
 //'@return a character vector of normalised addresses.
 //'
 //'@examples
@@ -37,9 +122,14 @@ void end() {
 //'@seealso \code{\link{parse_addr}} for parsing addresses.
 //'@export
 //[[Rcpp::export]]
-CharacterVector normalise_addr(CharacterVector addresses){
+CharacterVector normalise_addr(CharacterVector addresses, bool sanitise = false, std::string plan = "none"){
   poster_internal pinst;
-  return pinst.address_normalise(addresses);
+  engine_plan chosen = choose_plan(pinst, addresses, plan, POSTER_MODE_NORMALISE, sanitise);
+  CharacterVector output = pinst.address_normalise(addresses, sanitise, chosen);
+  if(chosen.planned){
+    output.attr("plan") = pinst.plan_info(chosen);
+  }
+  return output;
 }
 
 //'@title Parse street addresses
@@ -50,6 +140,32 @@ CharacterVector normalise_addr(CharacterVector addresses){
 //'
 //'@param addresses a character vector of addresses to parse.
 //'
+//'@param sanitise whether to clean addresses up before parsing them, so
+//'that addresses that differ only in their whitespace, invisible characters
+//'or Unicode normalisation form come out the same. See \code{\link{sanitise_addr}}.
+//'
+//'@param plan how to run the call. \code{"none"} runs every row in chunks of
+//'a fixed size. \code{"auto"} samples the addresses first, as
+//'\code{\link{plan_addr}} does, and chooses the chunk size and whether rows
+//'that repeat earlier ones are copied rather than run again; the plan it
+//'chose is in the output's \code{"plan"} attribute.
+//'
+//'@param normalise the columns to normalise as each address is parsed, such as
+//'\code{c("road", "city")}. Each is expanded with the options libpostal has
+//'for its kind of component - street names for \code{road}, place names for
+//'\code{city}, \code{state} and the other toponyms - and the first
+//'expansion replaces the parsed value, which is kept where there is none.
+//'This gives what calling \code{\link{normalise_addr}} on each column
+//'would, without going over the addresses again.
+//'
+//'@param lazy whether to keep the components natively rather than as R
+//'strings. Each column is then an ALTREP character vector over a heap of its
+//'values, and a value becomes an R string only when it is read, which saves
+//'most of the cost of parsing many addresses whose components are mostly
+//'never looked at. Code that needs the whole vector's memory gets an ordinary
+//'copy made then. Lazy columns are saved (with \code{saveRDS} and the like) in
+//'their compact form, and read back as lazy columns.
+//'
 //'@return a data.frame of 20 columns; \code{house}, \code{category},
 //'\code{near}, \code{house_number}, \code{road}, \code{unit},
 //'\code{level}, \code{staircase}, \code{entrance}, \code{po_box},
@@ -88,9 +204,28 @@ CharacterVector normalise_addr(CharacterVector addresses){
 //'
 //'@export
 //[[Rcpp::export]]
-DataFrame parse_addr(CharacterVector addresses){
+DataFrame parse_addr(CharacterVector addresses, bool sanitise = false, std::string plan = "none",
+                     CharacterVector normalise = CharacterVector::create(), bool lazy = false){
   poster_internal pinst;
-  return pinst.parse_addr(addresses);
+  uint32_t components = pinst.label_mask(normalise);
+  engine_plan chosen = choose_plan(pinst, addresses, plan, POSTER_MODE_PARSE, sanitise, components);
+  DataFrame output = pinst.parse_addr(addresses, sanitise, chosen, components, lazy);
+  if(chosen.planned){
+    output.attr("plan") = pinst.plan_info(chosen);
+  }
+  return output;
+}
+
+//[[Rcpp::export]]
+List plan_addr_(CharacterVector addresses, int mode, bool sanitise, CharacterVector normalise){
+  poster_internal pinst;
+  return pinst.plan_info(pinst.plan_engine(addresses, mode, sanitise, pinst.label_mask(normalise)));
+}
+
+//[[Rcpp::export]]
+CharacterVector sanitise_addr_(CharacterVector addresses){
+  poster_internal pinst;
+  return pinst.sanitise_addr(addresses);
 }
 
 //[[Rcpp::export]]
@@ -100,7 +235,461 @@ CharacterVector get_elements_(CharacterVector addresses, int element){
 }
 
 //[[Rcpp::export]]
-CharacterVector set_elements_(CharacterVector addresses, CharacterVector replacement, int element){
+CharacterVector set_elements_(CharacterVector addresses, CharacterVector replacement, int element,
+                              std::string country){
+  poster_internal pinst;
+  return pinst.set_elements(addresses, replacement, element, country);
+}
+
+//[[Rcpp::export]]
+List parse_tokens_(CharacterVector addresses){
+  poster_internal pinst;
+  return pinst.parse_tokens(addresses);
+}
+
+//[[Rcpp::export]]
+DataFrame compare_addr_(CharacterVector a, CharacterVector b, bool expand){
   poster_internal pinst;
-  return pinst.set_elements(addresses, replacement, element);
+  return pinst.compare_addr(a, b, expand);
+}
+
+// Stores are handed to R as external pointers, which don't survive being
+// saved and reloaded with the rest of a session.
+static parse_store* get_store(SEXP store){
+  parse_store* pointer = (parse_store*) R_ExternalPtrAddr(store);
+  if(pointer == NULL){
+    Rcpp::stop("This store is no longer valid; stores can be kept with save_store()");
+  }
+  return pointer;
+}
+
+static SEXP wrap_store(parse_store* store){
+  store->govern();
+  XPtr<parse_store> pointer(store, true);
+  pointer.attr("class") = "poster_store";
+  return pointer;
+}
+
+// Compiles templates, a character vector named by country, over poster's own.
+static void compile_formats(CharacterVector templates, address_formats& formats){
+  if(templates.size() == 0){
+    return;
+  }
+  CharacterVector countries = templates.names();
+  std::string error;
+  for(int i = 0; i < templates.size(); i++){
+    if(templates[i] == NA_STRING || countries[i] == NA_STRING ||
+       !formats.add(as<std::string>(countries[i]), as<std::string>(templates[i]), error)){
+      Rcpp::stop(error.empty() ? "templates must be a character vector named by country" : error);
+    }
+  }
+}
+
+//[[Rcpp::export]]
+DataFrame join_addr_(CharacterVector x, CharacterVector y, CharacterVector components, bool expand){
+  poster_internal pinst;
+  return pinst.join_addr(x, y, pinst.label_mask(components), expand);
+}
+
+//[[Rcpp::export]]
+SEXP link_addr_(CharacterVector x, SEXP y, List keys, bool expand, int window, double batch_size,
+                SEXP callback){
+  poster_internal pinst;
+  std::vector<std::vector<int> > labels;
+  for(unsigned int pass = 0; pass < keys.size(); pass++){
+    labels.push_back(pinst.label_list(keys[pass]));
+  }
+  bool single = Rf_isNull(y);
+  CharacterVector y_addresses = single ? CharacterVector() : CharacterVector(y);
+  return pinst.link_addr(x, y_addresses, single, labels, expand, std::max(0, window),
+                         batch_size < 1 ? 0 : (size_t) batch_size, callback);
+}
+
+//[[Rcpp::export]]
+CharacterVector format_addr_(List components, CharacterVector countries, CharacterVector templates,
+                             std::string separator){
+  poster_internal pinst;
+  address_formats formats;
+  compile_formats(templates, formats);
+  return pinst.format_addr(components, countries, formats, separator);
+}
+
+//[[Rcpp::export]]
+SEXP store_build_(CharacterVector addresses, double memory_limit, std::string spill_dir){
+  poster_internal pinst;
+  if(memory_limit < 0){
+    Rcpp::stop("memory_limit must be a number of bytes");
+  }
+  size_t limit = (memory_limit == R_PosInf) ? 0 : (size_t) memory_limit;
+  std::vector<unsigned int> failed;
+  std::vector<int> statuses;
+  SEXP store = PROTECT(wrap_store(pinst.build_store(addresses, limit, spill_dir, failed, statuses)));
+  pinst.record_status(store, addresses.size(), failed, statuses, "parsed");
+  UNPROTECT(1);
+  return store;
+}
+
+//[[Rcpp::export]]
+DataFrame store_rows_(SEXP store, IntegerVector rows){
+  poster_internal pinst;
+  return pinst.store_rows(*get_store(store), rows);
+}
+
+//[[Rcpp::export]]
+List store_info_(SEXP store){
+  poster_internal pinst;
+  return pinst.store_info(*get_store(store));
+}
+
+//[[Rcpp::export]]
+CharacterVector store_format_(SEXP store, CharacterVector countries, CharacterVector templates,
+                              std::string separator){
+  poster_internal pinst;
+  address_formats formats;
+  compile_formats(templates, formats);
+  return pinst.format_store(*get_store(store), countries, formats, separator);
+}
+
+//[[Rcpp::export]]
+void store_save_(SEXP store, std::string path){
+  if(!get_store(store)->save(path)){
+    Rcpp::stop("Could not write the store to " + path);
+  }
+}
+
+//[[Rcpp::export]]
+SEXP store_load_(std::string path){
+  parse_store* store = new parse_store();
+  if(!store->load(path)){
+    delete store;
+    Rcpp::stop(path + " is not a poster store, or is damaged");
+  }
+  return wrap_store(store);
+}
+
+//[[Rcpp::export]]
+List warm_up_(std::string datadir, int rounds){
+  size_t bytes = 0;
+  size_t files = 0;
+  std::chrono::steady_clock::time_point began = std::chrono::steady_clock::now();
+  if(!datadir.empty()){
+    files = poster_prefetch(datadir.c_str(), bytes);
+  }
+  std::chrono::steady_clock::time_point prefetched = std::chrono::steady_clock::now();
+  size_t rows = poster_warm_up(rounds);
+  std::chrono::steady_clock::time_point warmed = std::chrono::steady_clock::now();
+  return List::create(_["files"] = (double) files,
+                      _["bytes"] = (double) bytes,
+                      _["prefetch_seconds"] = std::chrono::duration<double>(prefetched - began).count(),
+                      _["rows"] = (double) rows,
+                      _["warm_up_seconds"] = std::chrono::duration<double>(warmed - prefetched).count());
+}
+
+//[[Rcpp::export]]
+NumericVector time_rows_(CharacterVector addresses, int mode, int reps, bool sanitise,
+                         CharacterVector normalise){
+  poster_internal pinst;
+  return pinst.time_rows(addresses, mode, reps, sanitise, pinst.label_mask(normalise));
+}
+
+//[[Rcpp::export]]
+double trim_buffers_(){
+  return buffer_pool::trim();
+}
+
+//[[Rcpp::export]]
+void set_buffer_budget_(double bytes){
+  if(bytes < 0){
+    Rcpp::stop("The budget must be a number of bytes");
+  }
+  buffer_pool::set_budget(bytes);
+}
+
+//[[Rcpp::export]]
+void set_resources_(double threads, double memory, bool cgroup){
+  if(!(threads >= 1) || !(memory >= 0)){
+    Rcpp::stop("threads must be at least 1 and memory a number of bytes");
+  }
+  resource_governor::set_limits(threads == R_PosInf ? SIZE_MAX : (size_t) threads,
+                                memory == R_PosInf ? SIZE_MAX : (size_t) memory, cgroup);
+}
+
+//[[Rcpp::export]]
+List resources_(){
+  size_t threads = resource_governor::thread_limit();
+  size_t memory = resource_governor::memory_limit();
+  size_t cgroup_cpus = resource_governor::cgroup_cpus();
+  size_t cgroup_memory = resource_governor::cgroup_memory();
+  return List::create(_["threads"] = threads == SIZE_MAX ? R_PosInf : (double) threads,
+                      _["memory"] = memory == SIZE_MAX ? R_PosInf : (double) memory,
+                      _["cgroup"] = resource_governor::obeys_cgroup(),
+                      _["threads_in_use"] = (double) resource_governor::threads_used(),
+                      _["memory_in_use"] = (double) resource_governor::memory_used(),
+                      _["cgroup_cpus"] = cgroup_cpus == 0 ? NA_REAL : (double) cgroup_cpus,
+                      _["cgroup_memory"] = cgroup_memory == 0 ? NA_REAL : (double) cgroup_memory);
+}
+
+//[[Rcpp::export]]
+bool memory_accounting_(bool enabled){
+  bool previous = memory_accounting::enabled;
+  memory_accounting::enabled = enabled;
+  return previous;
+}
+
+//[[Rcpp::export]]
+List memory_report_(){
+  const call_counts& counts = memory_accounting::last_call;
+  CharacterVector stage(STAGE_COUNT);
+  NumericVector allocations(STAGE_COUNT);
+  NumericVector bytes(STAGE_COUNT);
+  for(unsigned int i = 0; i < STAGE_COUNT; i++){
+    stage[i] = stage_names[i];
+    allocations[i] = counts.allocations[i];
+    bytes[i] = counts.bytes[i];
+  }
+  return List::create(_["stages"] = DataFrame::create(_["stage"] = stage,
+                                                      _["allocations"] = allocations,
+                                                      _["bytes"] = bytes,
+                                                      _["stringsAsFactors"] = false),
+                      _["libpostal_responses"] = (double) counts.libpostal_responses,
+                      _["libpostal_bytes"] = (double) counts.libpostal_bytes,
+                      _["r_vector_bytes"] = (double) counts.r_vector_bytes,
+                      _["rss_start"] = (double) counts.rss_start,
+                      _["rss_peak"] = (double) counts.rss_peak,
+                      _["rss_high_water"] = (double) memory_accounting::rss_high_water());
+}
+
+//[[Rcpp::export]]
+void trace_start_(int capacity){
+  if(capacity < 1){
+    Rcpp::stop("capacity must be a positive number of events");
+  }
+  tracing::start(capacity);
+}
+
+//[[Rcpp::export]]
+double trace_stop_(std::string path){
+  if(!tracing::enabled){
+    Rcpp::stop("Tracing has not been started");
+  }
+  return tracing::stop(path);
+}
+
+//[[Rcpp::export]]
+void service_start_(std::string path, double window, int max_batch, int workers,
+                    IntegerVector weights, NumericVector max_queue, double shed_bulk_at, double max_connections,
+                    bool sanitise){
+  if(window < 0 || max_batch < 1 || workers < 1){
+    Rcpp::stop("window must be non-negative, and max_batch and workers positive");
+  }
+  if(weights.size() != LANE_COUNT || max_queue.size() != LANE_COUNT || !(shed_bulk_at >= 1) ||
+     !(max_connections >= 1)){
+    Rcpp::stop("weights and max_queue need a value for each lane, and shed_bulk_at and max_connections must be positive");
+  }
+  service_options options;
+  options.window = std::chrono::nanoseconds((int64_t) (window * 1e9));
+  options.max_batch = max_batch;
+  options.workers = workers;
+  for(unsigned int lane = 0; lane < LANE_COUNT; lane++){
+    if(weights[lane] < 1 || !(max_queue[lane] >= 1)){
+      Rcpp::stop("weights and max_queue must be positive");
+    }
+    options.weights[lane] = weights[lane];
+    options.max_queue[lane] = max_queue[lane] == R_PosInf ? SIZE_MAX : (size_t) max_queue[lane];
+  }
+  options.shed_bulk_at = shed_bulk_at == R_PosInf ? SIZE_MAX : (size_t) shed_bulk_at;
+  options.max_connections = max_connections == R_PosInf ? SIZE_MAX : (size_t) max_connections;
+  options.sanitise = sanitise;
+  std::string error;
+  if(!service.start(path, options, error)){
+    Rcpp::stop(error);
+  }
+  if(service.worker_count() < (unsigned int) workers){
+    Rcpp::warning("The resource governor granted " + std::to_string(service.worker_count()) + " of " +
+                  std::to_string(workers) + " workers");
+  }
+}
+
+//[[Rcpp::export]]
+void service_stop_(){
+  service.stop();
+}
+
+//[[Rcpp::export]]
+List service_info_(){
+  double batches = service.batches_run;
+  NumericVector waiting(LANE_COUNT);
+  CharacterVector lanes(LANE_COUNT);
+  for(unsigned int lane = 0; lane < LANE_COUNT; lane++){
+    waiting[lane] = service.waiting[lane];
+    lanes[lane] = lane_names[lane];
+  }
+  waiting.attr("names") = lanes;
+  NumericVector rejections(REJECT_COUNT);
+  CharacterVector reasons(REJECT_COUNT);
+  for(unsigned int reason = 0; reason < REJECT_COUNT; reason++){
+    rejections[reason] = service.rejections[reason];
+    reasons[reason] = rejection_names[reason];
+  }
+  rejections.attr("names") = reasons;
+  return List::create(_["running"] = service.is_running(),
+                      _["path"] = service.is_running() ? service.socket_path() : std::string(),
+                      _["requests"] = (double) service.requests,
+                      _["batches"] = batches,
+                      _["rows_run"] = (double) service.rows_run,
+                      _["mean_batch"] = batches > 0 ? service.rows_run / batches : NA_REAL,
+                      _["waiting"] = waiting,
+                      _["rejections"] = rejections,
+                      _["model_version"] = (double) model_version,
+                      _["model_worker_pid"] = service.model_worker_pid() > 0 ?
+                        (double) service.model_worker_pid() : NA_REAL);
+}
+
+//[[Rcpp::export]]
+List service_load_test_(std::string path, std::vector<std::string> addresses, int clients, int requests,
+                        int lane, int background){
+  if(addresses.empty() || clients < 1 || requests < 1 || background < 0){
+    Rcpp::stop("Load tests need addresses, and a positive number of clients and requests");
+  }
+  if(lane < 0 || lane >= LANE_COUNT){
+    Rcpp::stop("Unknown lane");
+  }
+  std::vector<double> latencies;
+  size_t failures = 0;
+  size_t rejected = 0;
+  double seconds = service_load_test(path, addresses, clients, requests, lane, background,
+                                     latencies, failures, rejected);
+  return List::create(_["latencies"] = latencies,
+                      _["seconds"] = seconds,
+                      _["failures"] = (double) failures,
+                      _["rejected"] = (double) rejected);
+}
+
+//[[Rcpp::export]]
+std::string service_send_(std::string path, std::string request){
+  return service_send(path, request);
+}
+
+//[[Rcpp::export]]
+List reload_models_(std::string datadir, int rounds){
+  typedef std::chrono::steady_clock clock;
+  double load_seconds = 0;
+  double switch_seconds = 0;
+  double drain_seconds = 0;
+  bool switched = service.is_running();
+
+  // The new models are always loaded in a fresh worker first, so that a
+  // datadir that can't be loaded is found out before anything here has been
+  // torn down. Their files are prefetched beforehand, into the page cache
+  // that the worker and then this process read them from.
+  clock::time_point began = clock::now();
+  if(!datadir.empty()){
+    size_t bytes = 0;
+    poster_prefetch(datadir.c_str(), bytes);
+  }
+  std::shared_ptr<model_worker> fresh = std::make_shared<model_worker>();
+  std::string error;
+  if(!fresh->start(datadir, switched ? rounds : 0, error)){
+    Rcpp::stop(error);
+  }
+  clock::time_point loaded = clock::now();
+  load_seconds = std::chrono::duration<double>(loaded - began).count();
+  if(!switched){
+    fresh.reset();
+  }
+
+  // A running service is then moved onto the worker, loaded while the old
+  // models went on serving, and the old ones are released once the batches
+  // already running on them have finished. The version moves on with the
+  // switch, since from then on the service is serving the new models.
+  uint64_t version = model_version;
+  if(switched){
+    std::shared_ptr<model_worker> old = service.switch_models(fresh);
+    version = ++model_version;
+    clock::time_point switched_at = clock::now();
+    // The wait for them can be interrupted, and is given up after a while,
+    // so that a batch stuck on the old models can't hang the session.
+    clock::time_point deadline = switched_at + std::chrono::seconds(POSTER_DRAIN_SECONDS);
+    while(old.use_count() > 1){
+      if(clock::now() > deadline){
+        Rcpp::stop("Batches on the old models were still running after " + std::to_string(POSTER_DRAIN_SECONDS) +
+                   " seconds; the service has switched to the new models, in a worker it stays on, but this " +
+                   "process's were not reloaded");
+      }
+      Rcpp::checkUserInterrupt();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    old.reset();
+    switch_seconds = std::chrono::duration<double>(switched_at - loaded).count();
+    drain_seconds = std::chrono::duration<double>(clock::now() - switched_at).count();
+  }
+
+  // Nothing is using this process's own models any more, so they can be
+  // swapped in place. Should that still fail, the ones they replace are put
+  // back; without a service, the version is only advanced once the new ones
+  // are in.
+  clock::time_point process_began = clock::now();
+  bool reloaded, restored = false;
+  {
+    std::lock_guard<std::mutex> lock(libpostal_mutex);
+    std::string previous = model_datadir;
+    poster_teardown();
+    reloaded = poster_setup(datadir);
+    if(!reloaded){
+      poster_teardown();
+      restored = poster_setup(previous);
+    }
+  }
+  if(!reloaded){
+    Rcpp::stop(std::string("libpostal's models could not be reloaded in this process; ") +
+               (restored ? "the previous models are still in use" : "the previous ones could not be restored either") +
+               (switched ? ", although the service has switched to the new ones in its worker" : ""));
+  }
+
+  // The service is then pointed back at this process's models, now the new
+  // ones, so that two sets are only held while the switch is under way. The
+  // worker exits once the batches still running on it let it go.
+  if(switched){
+    fresh.reset();
+    service.switch_models(std::make_shared<model_worker>());
+  } else {
+    version = ++model_version;
+  }
+  return List::create(_["model_version"] = (double) version,
+                      _["service_switched"] = switched,
+                      _["load_seconds"] = load_seconds,
+                      _["switch_seconds"] = switch_seconds,
+                      _["drain_seconds"] = drain_seconds,
+                      _["process_seconds"] = std::chrono::duration<double>(clock::now() - process_began).count());
+}
+
+//[[Rcpp::export]]
+std::string metrics_text_(){
+  return metrics::render();
+}
+
+//[[Rcpp::export]]
+void metrics_serve_(int port){
+  std::string error;
+  if(port < 1 || port > 65535 || !exporter.serve(port, error)){
+    Rcpp::stop(error.empty() ? "port must be between 1 and 65535" : error);
+  }
+}
+
+//[[Rcpp::export]]
+void metrics_write_(std::string path, double interval){
+  std::string error;
+  if(!(interval > 0) || !exporter.write(path, std::chrono::milliseconds((int64_t) (interval * 1000)), error)){
+    Rcpp::stop(error.empty() ? "interval must be a positive number of seconds" : error);
+  }
+}
+
+//[[Rcpp::export]]
+void metrics_stop_(){
+  exporter.stop();
+}
+
+// Called by R as the package's library is loaded.
+extern "C" void R_init_poster(DllInfo* dll){
+  init_string_column(dll);
 }
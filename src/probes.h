@@ -0,0 +1,19 @@
+// USDT probes for watching poster with bpftrace or perf, e.g.
+//   bpftrace -e 'usdt:/path/to/poster.so:poster:parse_end { @[tid] = count(); }'
+// They are compiled in when configure finds sys/sdt.h (and
+// POSTER_DISABLE_USDT isn't set), and to nothing otherwise.
+#ifndef __POSTER_PROBES__
+#define __POSTER_PROBES__
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define POSTER_PROBE(name) DTRACE_PROBE(poster, name)
+#define POSTER_PROBE1(name, a) DTRACE_PROBE1(poster, name, a)
+#define POSTER_PROBE2(name, a, b) DTRACE_PROBE2(poster, name, a, b)
+#else
+#define POSTER_PROBE(name) do {} while(0)
+#define POSTER_PROBE1(name, a) do {} while(0)
+#define POSTER_PROBE2(name, a, b) do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cstring>
+#include "sanitise.h"
+#include "compositions.h"
+
+static bool is_space(uint32_t c){
+  return c == ' ' || (c >= 0x09 && c <= 0x0D) || c == 0x85 || c == 0xA0 || c == 0x1680 ||
+    (c >= 0x2000 && c <= 0x200A) || c == 0x2028 || c == 0x2029 || c == 0x202F || c == 0x205F ||
+    c == 0x3000;
+}
+
+// Control characters, soft hyphens, zero-width characters, and the marks and
+// embeddings that only steer the direction text is laid out in.
+static bool is_dropped(uint32_t c){
+  return c < 0x20 || (c >= 0x7F && c <= 0x9F) || c == 0xAD || c == 0x180E ||
+    (c >= 0x200B && c <= 0x200F) || (c >= 0x202A && c <= 0x202E) ||
+    (c >= 0x2060 && c <= 0x2064) || (c >= 0x2066 && c <= 0x206F) || c == 0xFEFF;
+}
+
+static bool composition_before(const composition& entry, uint32_t key){
+  return entry.key < key;
+}
+
+// The character base and mark compose into, or 0 if they don't.
+static uint32_t compose(uint32_t base, uint32_t mark){
+  // Hangul syllables are composed arithmetically, from a leading consonant
+  // and a vowel and then from that and a trailing consonant.
+  if(base >= 0x1100 && base < 0x1113 && mark >= 0x1161 && mark < 0x1176){
+    return 0xAC00 + ((base - 0x1100) * 21 + (mark - 0x1161)) * 28;
+  }
+  if(base >= 0xAC00 && base < 0xD7A4 && (base - 0xAC00) % 28 == 0 && mark > 0x11A7 && mark < 0x11C3){
+    return base + (mark - 0x11A7);
+  }
+  if(base > 0xFFFF || mark > 0xFFFF){
+    return 0;
+  }
+  uint32_t key = (base << 16) | mark;
+  const composition* end = compositions + sizeof(compositions) / sizeof(compositions[0]);
+  const composition* found = std::lower_bound(compositions, end, key, composition_before);
+  return (found != end && found->key == key) ? found->composed : 0;
+}
+
+static void append_utf8(uint32_t c, poster_string& output){
+  if(c < 0x80){
+    output.push_back(c);
+  } else if(c < 0x800){
+    output.push_back(0xC0 | (c >> 6));
+    output.push_back(0x80 | (c & 0x3F));
+  } else if(c < 0x10000){
+    output.push_back(0xE0 | (c >> 12));
+    output.push_back(0x80 | ((c >> 6) & 0x3F));
+    output.push_back(0x80 | (c & 0x3F));
+  } else {
+    output.push_back(0xF0 | (c >> 18));
+    output.push_back(0x80 | ((c >> 12) & 0x3F));
+    output.push_back(0x80 | ((c >> 6) & 0x3F));
+    output.push_back(0x80 | (c & 0x3F));
+  }
+}
+
+// Whether an all-ASCII row is already clean: no control characters, no
+// whitespace but single spaces, and none of those at either end.
+static bool ascii_clean(const char* x, size_t size){
+  if(size == 0){
+    return true;
+  }
+  if(x[0] == ' ' || x[size - 1] == ' '){
+    return false;
+  }
+  for(size_t i = 0; i < size; i++){
+    unsigned char c = x[i];
+    if(c < 0x20 || c == 0x7F || (c == ' ' && x[i + 1] == ' ')){
+      return false;
+    }
+  }
+  return true;
+}
+
+bool poster_sanitise(const char* x, size_t size, poster_string& output){
+
+  if(poster_ascii_prefix(x, size) == size && ascii_clean(x, size)){
+    return false;
+  }
+
+  const unsigned char* s = (const unsigned char*) x;
+  output.clear();
+  bool space = false;
+  // The last character written, which the next may compose with, and where
+  // it starts in output.
+  uint32_t previous = 0;
+  size_t previous_at = 0;
+  size_t i = 0;
+  while(i < size){
+    uint32_t c;
+    size_t length = poster_utf8_decode(s + i, size - i, c);
+    if(length == 0){
+      i++;
+      continue;
+    }
+    i += length;
+    if(is_space(c)){
+      space = !output.empty();
+      continue;
+    }
+    if(is_dropped(c)){
+      continue;
+    }
+    if(space){
+      output.push_back(' ');
+      space = false;
+      previous = 0;
+    }
+    uint32_t composed = previous == 0 ? 0 : compose(previous, c);
+    if(composed != 0){
+      output.resize(previous_at);
+      c = composed;
+    } else {
+      previous_at = output.size();
+    }
+    append_utf8(c, output);
+    previous = c;
+  }
+
+  return output.size() != size || memcmp(output.data(), x, size) != 0;
+}
@@ -0,0 +1,15 @@
+#include "core.h"
+
+#ifndef __POSTER_SANITISE__
+#define __POSTER_SANITISE__
+
+// Cleans up the size bytes at x into output, so that addresses that differ
+// only in ways that don't matter come out the same: invalid UTF-8 and
+// control, format and zero-width characters are dropped; runs of any kind of
+// whitespace become one space, and leading and trailing whitespace goes; and
+// base characters are composed with the combining marks that follow them, as
+// NFC does. Rows that are all ASCII take a fast path that skips decoding.
+// Returns false if x needed no change, in which case output is meaningless.
+bool poster_sanitise(const char* x, size_t size, poster_string& output);
+
+#endif
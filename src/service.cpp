@@ -0,0 +1,666 @@
+#include <cstring>
+#include <unordered_map>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "governor.h"
+#include "metrics.h"
+#include "model_worker.h"
+#include "sanitise.h"
+
+const char* lane_names[LANE_COUNT] = {
+  "interactive",
+  "bulk"
+};
+
+const char* rejection_names[REJECT_COUNT] = {
+  "queue_full",
+  "overloaded",
+  "stopping",
+  "too_many_connections"
+};
+
+// Appends x to output as a JSON string.
+static void append_json(std::string& output, const char* x, size_t size){
+  static const char hex[] = "0123456789abcdef";
+  output += '"';
+  for(size_t i = 0; i < size; i++){
+    unsigned char c = x[i];
+    switch(c){
+    case '"': output += "\\\""; break;
+    case '\\': output += "\\\\"; break;
+    case '\n': output += "\\n"; break;
+    case '\r': output += "\\r"; break;
+    case '\t': output += "\\t"; break;
+    default:
+      if(c < 0x20){
+        output += "\\u00";
+        output += hex[c >> 4];
+        output += hex[c & 0xf];
+      } else {
+        output += (char) c;
+      }
+    }
+  }
+  output += '"';
+}
+
+void service_respond(int mode, const std::string& address, service_scratch& scratch, std::string& response){
+  response = "ok\t";
+  int status = POSTER_STATUS_OK;
+  try {
+    if(mode == POSTER_MODE_PARSE){
+      status = poster_parse(address.c_str(), scratch.parser_options, scratch.parsed);
+      response += '{';
+      bool first = true;
+      for(unsigned int n = 0; n < PARSER_LABEL_COUNT; n++){
+        const poster_string& component = scratch.parsed.components[n];
+        if(!component.empty()){
+          if(!first){
+            response += ',';
+          }
+          first = false;
+          append_json(response, label_names[n], strlen(label_names[n]));
+          response += ':';
+          append_json(response, component.data(), component.size());
+        }
+      }
+      response += '}';
+    } else if(poster_expand(address.c_str(), scratch.normalize_options, scratch.expanded, &status)){
+      append_json(response, scratch.expanded.data(), scratch.expanded.size());
+    } else {
+      response += "null";
+    }
+  } catch(std::exception& e){
+    response = std::string("error\t") + e.what();
+  }
+  if(status != POSTER_STATUS_OK){
+    response = std::string("error\t") + status_names[status];
+  }
+}
+
+// Writes all of data to fd, returning false if the connection has gone.
+static bool send_all(int fd, const std::string& data){
+  size_t sent = 0;
+  while(sent < data.size()){
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+// Reads from fd until buffer holds a full line, moving it (without its
+// newline) into line. Returns false once the connection has closed.
+static bool read_line(int fd, std::string& buffer, std::string& line){
+  size_t newline;
+  while((newline = buffer.find('\n')) == std::string::npos){
+    char chunk[4096];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      return false;
+    }
+    buffer.append(chunk, n);
+  }
+  line.assign(buffer, 0, newline);
+  buffer.erase(0, newline + 1);
+  if(!line.empty() && line[line.size() - 1] == '\r'){
+    line.erase(line.size() - 1);
+  }
+  return true;
+}
+
+static int connect_to(const std::string& path){
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0){
+    return -1;
+  }
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  if(connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0){
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+parse_service::parse_service() : listen_fd(-1), running(false), batcher_stopping(false), workers_stopping(false),
+  requests(0), batches_run(0), rows_run(0) {
+  for(unsigned int lane = 0; lane < LANE_COUNT; lane++){
+    waiting[lane] = 0;
+    credits[lane] = 0;
+  }
+  for(unsigned int reason = 0; reason < REJECT_COUNT; reason++){
+    rejections[reason] = 0;
+  }
+}
+
+bool parse_service::start(const std::string& path, const service_options& options, std::string& error){
+  if(running){
+    error = "The service is already running on " + this->path;
+    return false;
+  }
+  struct sockaddr_un address;
+  if(path.empty() || path.size() >= sizeof(address.sun_path)){
+    error = "The socket path must be between 1 and " + std::to_string(sizeof(address.sun_path) - 1) + " characters";
+    return false;
+  }
+
+  // Workers are drawn from the resource governor, which may grant fewer
+  // than asked for, and are held until the service stops.
+  size_t granted = resource_governor::acquire_threads(options.workers);
+  if(granted == 0){
+    error = "No worker threads are free under the resource governor's limit; see set_resources()";
+    return false;
+  }
+
+  // Only clear a stale socket out of the way, never any other kind of file.
+  struct stat existing;
+  if(lstat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)){
+    unlink(path.c_str());
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+     listen(listen_fd, SOMAXCONN) != 0 || pipe(wake_fds) != 0){
+    error = "Could not listen on " + path + ": " + strerror(errno);
+    if(listen_fd >= 0){
+      close(listen_fd);
+      listen_fd = -1;
+    }
+    resource_governor::release_threads(granted);
+    return false;
+  }
+
+  this->path = path;
+  this->options = options;
+  this->options.workers = granted;
+  batcher_stopping = false;
+  workers_stopping = false;
+  std::atomic_store(&models, std::make_shared<model_worker>());
+  running = true;
+  for(unsigned int i = 0; i < this->options.workers; i++){
+    workers.push_back(std::thread(&parse_service::work_loop, this));
+  }
+  batcher = std::thread(&parse_service::batch_loop, this);
+  listener = std::thread(&parse_service::listen_loop, this);
+  return true;
+}
+
+void parse_service::stop(){
+  if(!running.exchange(false)){
+    return;
+  }
+
+  // Stop accepting, then close every connection for reading and wait for
+  // their threads to answer whatever they were waiting on and exit.
+  char wake = 0;
+  if(write(wake_fds[1], &wake, 1) < 0){
+    shutdown(listen_fd, SHUT_RDWR);
+  }
+  listener.join();
+  close(listen_fd);
+  close(wake_fds[0]);
+  close(wake_fds[1]);
+  listen_fd = -1;
+  unlink(path.c_str());
+  {
+    std::unique_lock<std::mutex> lock(connections_mutex);
+    for(unsigned int i = 0; i < connections.size(); i++){
+      shutdown(connections[i], SHUT_RD);
+    }
+    connections_done.wait(lock, [this]{ return connections.empty(); });
+  }
+
+  // The batcher and then the workers drain what they hold before exiting.
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    batcher_stopping = true;
+  }
+  pending_ready.notify_all();
+  batcher.join();
+  {
+    std::lock_guard<std::mutex> lock(batches_mutex);
+    workers_stopping = true;
+  }
+  batches_ready.notify_all();
+  for(unsigned int i = 0; i < workers.size(); i++){
+    workers[i].join();
+  }
+  resource_governor::release_threads(workers.size());
+  workers.clear();
+  std::atomic_store(&models, std::shared_ptr<model_worker>());
+}
+
+void parse_service::listen_loop(){
+  struct pollfd fds[2];
+  fds[0].fd = listen_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = wake_fds[0];
+  fds[1].events = POLLIN;
+  while(running){
+    if(poll(fds, 2, -1) < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      break;
+    }
+    if(fds[1].revents != 0){
+      break;
+    }
+    if(fds[0].revents & POLLIN){
+      int fd = accept(listen_fd, NULL, NULL);
+      if(fd < 0){
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(connections_mutex);
+      if(connections.size() >= options.max_connections){
+        send_all(fd, reject(REJECT_CONNECTIONS) + "\n");
+        close(fd);
+        continue;
+      }
+      connections.push_back(fd);
+      std::thread(&parse_service::serve_connection, this, fd).detach();
+    }
+  }
+}
+
+void parse_service::serve_connection(int fd){
+  std::string buffer;
+  std::string line;
+  while(read_line(fd, buffer, line)){
+    int mode = POSTER_MODE_PARSE;
+    int lane = LANE_INTERACTIVE;
+    size_t tab = line.find('\t');
+    if(tab != std::string::npos){
+      std::string verb = line.substr(0, tab);
+      line.erase(0, tab + 1);
+      size_t colon = verb.find(':');
+      if(colon != std::string::npos){
+        std::string lane_name = verb.substr(colon + 1);
+        verb.erase(colon);
+        lane = -1;
+        for(int i = 0; i < LANE_COUNT; i++){
+          if(lane_name == lane_names[i]){
+            lane = i;
+          }
+        }
+        // An unknown lane is turned away whatever the verb, before it can
+        // index anything kept per lane.
+        if(lane < 0){
+          if(!send_all(fd, "error\tUnknown lane " + lane_name + "\n")){
+            break;
+          }
+          continue;
+        }
+      }
+      if(verb == "normalise"){
+        mode = POSTER_MODE_NORMALISE;
+      } else if(verb != "parse"){
+        if(!send_all(fd, "error\tUnknown request type " + verb + "\n")){
+          break;
+        }
+        continue;
+      }
+    }
+    if(!send_all(fd, call(mode, lane, line) + "\n")){
+      break;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(connections_mutex);
+  for(unsigned int i = 0; i < connections.size(); i++){
+    if(connections[i] == fd){
+      connections.erase(connections.begin() + i);
+      break;
+    }
+  }
+  close(fd);
+  connections_done.notify_all();
+}
+
+std::string parse_service::reject(int reason){
+  rejections[reason]++;
+  metrics::count((poster_counter) (COUNTER_REJECTED_QUEUE_FULL + reason));
+  return std::string("rejected\t") + rejection_names[reason];
+}
+
+std::string parse_service::call(int mode, int lane, const std::string& address){
+  service_request request;
+  request.mode = mode;
+  request.lane = lane;
+  request.address = address;
+  if(options.sanitise){
+    poster_string sanitised;
+    if(poster_sanitise(address.data(), address.size(), sanitised)){
+      request.address.assign(sanitised.data(), sanitised.size());
+    }
+  }
+  request.arrived = std::chrono::steady_clock::now();
+  std::future<std::string> response = request.response.get_future();
+  requests++;
+  metrics::count((poster_counter) (COUNTER_REQUESTS_INTERACTIVE + lane));
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    if(batcher_stopping){
+      return reject(REJECT_STOPPING);
+    }
+    if(waiting[lane] >= options.max_queue[lane]){
+      return reject(REJECT_QUEUE_FULL);
+    }
+    if(lane == LANE_BULK && waiting[LANE_INTERACTIVE] >= options.shed_bulk_at){
+      return reject(REJECT_OVERLOADED);
+    }
+    waiting[lane]++;
+    pending[lane].push_back(&request);
+  }
+  pending_ready.notify_one();
+  std::string line = response.get();
+  metrics::observe((poster_histogram) lane, std::chrono::steady_clock::now() - request.arrived);
+  return line;
+}
+
+bool parse_service::pending_empty() const {
+  for(unsigned int lane = 0; lane < LANE_COUNT; lane++){
+    if(!pending[lane].empty()){
+      return false;
+    }
+  }
+  return true;
+}
+
+// Waits for requests, holds each lane's oldest for the window (or until a
+// full batch has arrived) so that others can join it, and dispatches what
+// has gathered in each lane that is due.
+void parse_service::batch_loop(){
+  typedef std::chrono::steady_clock clock;
+  std::unique_lock<std::mutex> lock(pending_mutex);
+  std::vector<service_request*> taken;
+  while(true){
+    pending_ready.wait(lock, [this]{ return !pending_empty() || batcher_stopping; });
+    if(pending_empty()){
+      break;
+    }
+    clock::time_point deadline = clock::time_point::max();
+    for(unsigned int lane = 0; lane < LANE_COUNT; lane++){
+      if(!pending[lane].empty()){
+        deadline = std::min(deadline, pending[lane].front()->arrived + options.window);
+      }
+    }
+    pending_ready.wait_until(lock, deadline, [this]{
+      for(unsigned int lane = 0; lane < LANE_COUNT; lane++){
+        if(pending[lane].size() >= options.max_batch){
+          return true;
+        }
+      }
+      return batcher_stopping;
+    });
+
+    clock::time_point now = clock::now();
+    for(unsigned int lane = 0; lane < LANE_COUNT; lane++){
+      std::deque<service_request*>& queue = pending[lane];
+      if(queue.empty() || (queue.size() < options.max_batch && !batcher_stopping &&
+                           queue.front()->arrived + options.window > now)){
+        continue;
+      }
+      size_t count = std::min(queue.size(), options.max_batch);
+      taken.assign(queue.begin(), queue.begin() + count);
+      queue.erase(queue.begin(), queue.begin() + count);
+      lock.unlock();
+      dispatch(lane, taken);
+      lock.lock();
+    }
+  }
+}
+
+// Groups the requests taken into a batch by what they ask for, so that each
+// distinct request is only run once, and queues it in its lane.
+void parse_service::dispatch(int lane, std::vector<service_request*>& taken){
+  service_batch batch;
+  batch.lane = lane;
+  batch.number = -1;
+  std::unordered_map<std::string, size_t> seen;
+  std::string key;
+  for(unsigned int i = 0; i < taken.size(); i++){
+    key.assign(1, (char) ('0' + taken[i]->mode));
+    key += taken[i]->address;
+    std::pair<std::unordered_map<std::string, size_t>::iterator, bool> entry =
+      seen.insert(std::make_pair(key, batch.distinct.size()));
+    if(entry.second){
+      batch.distinct.push_back(taken[i]);
+      batch.waiters.push_back(std::vector<service_request*>());
+    }
+    batch.waiters[entry.first->second].push_back(taken[i]);
+  }
+  metrics::count(COUNTER_COALESCED, taken.size() - batch.distinct.size());
+  metrics::count(COUNTER_CACHE_HITS_SERVICE, taken.size() - batch.distinct.size());
+  metrics::count(COUNTER_CACHE_MISSES_SERVICE, batch.distinct.size());
+  {
+    std::lock_guard<std::mutex> lock(batches_mutex);
+    batches[lane].push_back(std::move(batch));
+  }
+  batches_ready.notify_one();
+}
+
+// Picks the lane to take the next batch from by smooth weighted round robin
+// over the lanes with batches queued, so that each gets its share in
+// proportion to its weight and none is starved. Called with batches_mutex
+// held and at least one batch queued.
+int parse_service::next_lane(){
+  int chosen = -1;
+  int total = 0;
+  for(int lane = 0; lane < LANE_COUNT; lane++){
+    if(!batches[lane].empty()){
+      credits[lane] += options.weights[lane];
+      total += options.weights[lane];
+      if(chosen < 0 || credits[lane] > credits[chosen]){
+        chosen = lane;
+      }
+    }
+  }
+  credits[chosen] -= total;
+  return chosen;
+}
+
+// Runs batches from the lanes in turn. Bulk batches are run a slice at a
+// time, and if an interactive batch has arrived in the meantime the rest is
+// put back at the head of its lane, so that an interactive request never
+// waits behind more than a slice of bulk work.
+void parse_service::work_loop(){
+  service_scratch scratch;
+  std::vector<service_request*> slice;
+  std::vector<std::string> responses;
+
+  while(true){
+    service_batch batch;
+    {
+      std::unique_lock<std::mutex> lock(batches_mutex);
+      batches_ready.wait(lock, [this]{
+        return !batches[LANE_INTERACTIVE].empty() || !batches[LANE_BULK].empty() || workers_stopping;
+      });
+      if(batches[LANE_INTERACTIVE].empty() && batches[LANE_BULK].empty()){
+        return;
+      }
+      int lane = next_lane();
+      batch = std::move(batches[lane].front());
+      batches[lane].pop_front();
+    }
+
+    if(batch.number < 0){
+      batch.number = batches_run++;
+      metrics::count(COUNTER_BATCHES);
+    }
+    trace_scope trace("batch", batch.number);
+    size_t done = 0;
+    while(done < batch.distinct.size()){
+      size_t end = batch.distinct.size();
+      if(batch.lane == LANE_BULK){
+        end = std::min(end, done + POSTER_SERVICE_SLICE);
+      }
+      slice.assign(batch.distinct.begin() + done, batch.distinct.begin() + end);
+      std::shared_ptr<model_worker> worker = std::atomic_load(&models);
+      if(!worker->run(slice, responses, scratch)){
+        // The worker has died. The service falls back on this process's own
+        // models, which reloading brings up to date once it has switched, and
+        // the slice is run again on whichever models it now has.
+        std::shared_ptr<model_worker> fallback = std::make_shared<model_worker>();
+        std::atomic_compare_exchange_strong(&models, &worker, fallback);
+        worker = std::atomic_load(&models);
+        if(!worker->run(slice, responses, scratch)){
+          responses.assign(slice.size(), "error\tThe model worker has exited");
+        }
+      }
+      worker.reset();
+
+      rows_run += slice.size();
+      for(size_t i = done; i < end; i++){
+        waiting[batch.lane] -= batch.waiters[i].size();
+        if(responses[i - done].compare(0, 6, "error\t") == 0){
+          metrics::count(COUNTER_ERRORS, batch.waiters[i].size());
+        }
+        for(unsigned int j = 0; j < batch.waiters[i].size(); j++){
+          batch.waiters[i][j]->response.set_value(responses[i - done]);
+        }
+      }
+      done = end;
+
+      if(done < batch.distinct.size()){
+        std::lock_guard<std::mutex> lock(batches_mutex);
+        if(!batches[LANE_INTERACTIVE].empty()){
+          batch.distinct.erase(batch.distinct.begin(), batch.distinct.begin() + done);
+          batch.waiters.erase(batch.waiters.begin(), batch.waiters.begin() + done);
+          batches[batch.lane].push_front(std::move(batch));
+          break;
+        }
+      }
+    }
+  }
+}
+
+long parse_service::model_worker_pid(){
+  std::shared_ptr<model_worker> worker = std::atomic_load(&models);
+  return worker ? worker->process_id() : -1;
+}
+
+std::shared_ptr<model_worker> parse_service::switch_models(std::shared_ptr<model_worker> worker){
+  return std::atomic_exchange(&models, worker);
+}
+
+// Builds the request line for address in lane, keeping it to one line.
+static void load_request(const std::string& address, int lane, std::string& request){
+  request = lane == LANE_BULK ? "parse:bulk\t" : "parse\t";
+  size_t start = request.size();
+  request += address;
+  for(size_t i = start; i < request.size(); i++){
+    if(request[i] == '\n' || request[i] == '\r'){
+      request[i] = ' ';
+    }
+  }
+  request += '\n';
+}
+
+std::string service_send(const std::string& path, const std::string& request){
+  int fd = connect_to(path);
+  if(fd < 0){
+    return "";
+  }
+  std::string buffer;
+  std::string line;
+  if(!send_all(fd, request + "\n") || !read_line(fd, buffer, line)){
+    line.clear();
+  }
+  close(fd);
+  return line;
+}
+
+double service_load_test(const std::string& path, const std::vector<std::string>& addresses,
+                         unsigned int clients, unsigned int requests, int lane, unsigned int background,
+                         std::vector<double>& latencies, size_t& failures, size_t& rejected){
+
+  std::vector<std::vector<double> > client_latencies(clients);
+  std::vector<size_t> client_failures(clients, 0);
+  std::vector<size_t> client_rejected(clients, 0);
+  std::vector<std::thread> threads;
+  std::atomic<bool> done(false);
+
+  for(unsigned int b = 0; b < background; b++){
+    threads.push_back(std::thread([&, b]{
+      int fd = connect_to(path);
+      if(fd < 0){
+        return;
+      }
+      std::string buffer;
+      std::string line;
+      std::string request;
+      for(size_t r = b; !done; r++){
+        load_request(addresses[r % addresses.size()], LANE_BULK, request);
+        if(!send_all(fd, request) || !read_line(fd, buffer, line)){
+          break;
+        }
+        if(line.compare(0, 9, "rejected\t") == 0){
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+      close(fd);
+    }));
+  }
+
+  std::chrono::steady_clock::time_point began = std::chrono::steady_clock::now();
+  for(unsigned int c = 0; c < clients; c++){
+    threads.push_back(std::thread([&, c]{
+      int fd = connect_to(path);
+      if(fd < 0){
+        client_failures[c] = requests;
+        return;
+      }
+      std::string buffer;
+      std::string line;
+      std::string request;
+      client_latencies[c].reserve(requests);
+      for(unsigned int r = 0; r < requests; r++){
+        load_request(addresses[((size_t) c * requests + r) % addresses.size()], lane, request);
+        std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+        if(!send_all(fd, request) || !read_line(fd, buffer, line)){
+          client_failures[c] += requests - r;
+          break;
+        }
+        if(line.compare(0, 9, "rejected\t") == 0){
+          client_rejected[c]++;
+          continue;
+        }
+        client_latencies[c].push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - sent).count());
+        if(line.compare(0, 3, "ok\t") != 0){
+          client_failures[c]++;
+        }
+      }
+      close(fd);
+    }));
+  }
+  for(unsigned int c = 0; c < clients; c++){
+    threads[background + c].join();
+    latencies.insert(latencies.end(), client_latencies[c].begin(), client_latencies[c].end());
+    failures += client_failures[c];
+    rejected += client_rejected[c];
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+  done = true;
+  for(unsigned int b = 0; b < background; b++){
+    threads[b].join();
+  }
+  return seconds;
+}
@@ -0,0 +1,209 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "core.h"
+
+#ifndef __POSTER_SERVICE__
+#define __POSTER_SERVICE__
+
+// The most distinct requests of a bulk batch run before checking whether
+// interactive work is waiting.
+#define POSTER_SERVICE_SLICE 16
+
+// The lanes requests queue in. Each is batched separately, and workers pick
+// the next batch from among them by weight.
+enum service_lane {
+  LANE_INTERACTIVE,
+  LANE_BULK,
+  LANE_COUNT
+};
+
+extern const char* lane_names[LANE_COUNT];
+
+// The reasons a request can be turned away without being run.
+enum service_rejection {
+  REJECT_QUEUE_FULL,
+  REJECT_OVERLOADED,
+  REJECT_STOPPING,
+  REJECT_CONNECTIONS,
+  REJECT_COUNT
+};
+
+extern const char* rejection_names[REJECT_COUNT];
+
+// How the service gathers requests into batches and runs them. A lane
+// admits at most max_queue requests waiting for a response; bulk requests
+// are shed outright while shed_bulk_at or more interactive ones are waiting.
+// With sanitise, addresses are sanitised as they arrive, so that more of
+// them are found to be duplicates. Each connection is served by a thread of
+// its own, mostly blocked reading, so at most max_connections are open at
+// once; more are turned away as they arrive.
+struct service_options {
+  std::chrono::nanoseconds window;
+  size_t max_batch;
+  unsigned int workers;
+  unsigned int weights[LANE_COUNT];
+  size_t max_queue[LANE_COUNT];
+  size_t shed_bulk_at;
+  size_t max_connections;
+  bool sanitise;
+};
+
+// One caller's request, answered through its promise.
+struct service_request {
+  int mode;
+  int lane;
+  std::string address;
+  std::chrono::steady_clock::time_point arrived;
+  std::promise<std::string> response;
+};
+
+// The distinct requests in a batch, each with every request waiting on it.
+struct service_batch {
+  int lane;
+  int64_t number;
+  std::vector<service_request*> distinct;
+  std::vector<std::vector<service_request*> > waiters;
+};
+
+// What answering requests needs, kept between them.
+struct service_scratch {
+  libpostal_address_parser_options_t parser_options;
+  libpostal_normalize_options_t normalize_options;
+  parsed_address parsed;
+  poster_string expanded;
+  service_scratch() : parser_options(libpostal_get_address_parser_default_options()),
+    normalize_options(libpostal_get_default_options()) {}
+};
+
+// Runs address through libpostal in mode, writing the response line (without
+// its newline) to response.
+void service_respond(int mode, const std::string& address, service_scratch& scratch, std::string& response);
+
+class model_worker;
+
+// Serves parses and normalisations over a Unix domain socket, a request per
+// line and a response per line. Requests that arrive within a window of the
+// first one waiting are gathered into a micro-batch, duplicates within it are
+// run once, and the batch is handed to a pool of workers which fan the
+// results back out to every caller, using whichever model_worker the
+// service has been switched to - to begin with, this process's own models,
+// a worker's while reloading switches models, and this process's again once
+// it has reloaded them or should the worker die.
+//
+// A request is "parse\t<address>" or "normalise\t<address>" (or just the
+// address, to parse it), with ":bulk" after the verb to queue it in the bulk
+// lane; a response is "ok\t<JSON>", "error\t<message>" or, if the request
+// was turned away, "rejected\t<reason>".
+class parse_service {
+
+private:
+
+  service_options options;
+  std::string path;
+  int listen_fd;
+  int wake_fds[2];
+  std::atomic<bool> running;
+
+  std::thread listener;
+  std::thread batcher;
+  std::vector<std::thread> workers;
+
+  std::mutex connections_mutex;
+  std::condition_variable connections_done;
+  std::vector<int> connections;
+
+  std::mutex pending_mutex;
+  std::condition_variable pending_ready;
+  std::deque<service_request*> pending[LANE_COUNT];
+  bool batcher_stopping;
+
+  std::mutex batches_mutex;
+  std::condition_variable batches_ready;
+  std::deque<service_batch> batches[LANE_COUNT];
+  int credits[LANE_COUNT];
+  bool workers_stopping;
+
+  std::shared_ptr<model_worker> models;
+
+  void listen_loop();
+
+  void serve_connection(int fd);
+
+  void batch_loop();
+
+  bool pending_empty() const;
+
+  void dispatch(int lane, std::vector<service_request*>& taken);
+
+  int next_lane();
+
+  std::string reject(int reason);
+
+  void work_loop();
+
+public:
+
+  std::atomic<uint64_t> requests;
+  std::atomic<uint64_t> batches_run;
+  std::atomic<uint64_t> rows_run;
+  std::atomic<uint64_t> waiting[LANE_COUNT];
+  std::atomic<uint64_t> rejections[REJECT_COUNT];
+
+  parse_service();
+
+  ~parse_service(){ stop(); }
+
+  // How many workers it runs, which the resource governor may have made
+  // fewer than asked for.
+  unsigned int worker_count() const { return workers.size(); }
+
+  // Starts listening on path, returning false and setting error if it can't.
+  bool start(const std::string& path, const service_options& options, std::string& error);
+
+  // Stops listening, lets requests already accepted finish, and then stops
+  // the batcher and workers. Safe to call when it isn't running.
+  void stop();
+
+  bool is_running() const { return running; }
+
+  const std::string& socket_path() const { return path; }
+
+  const service_options& settings() const { return options; }
+
+  // Queues a request in lane and waits for its response line, or turns it
+  // away if the lane is full or the service is shedding it.
+  std::string call(int mode, int lane, const std::string& address);
+
+  // Sends every batch from now on to worker, returning the one that was in
+  // use. Batches already running finish on it, holding a reference to it
+  // until they're done.
+  std::shared_ptr<model_worker> switch_models(std::shared_ptr<model_worker> worker);
+
+  // The process the service's models are in, or -1 if they're this one's.
+  long model_worker_pid();
+
+};
+
+// Sends the service at path a single request line, as a client would, and
+// returns its response line, or "" if the connection failed.
+std::string service_send(const std::string& path, const std::string& request);
+
+// A closed-loop load generator: clients connect to the service at path and
+// each sends requests requests in lane one after another, cycling through
+// addresses, recording how long each took to be answered in latencies.
+// Meanwhile background clients send bulk requests as fast as they are
+// answered. Returns the wall-clock seconds taken, adding the requests that
+// failed to failures and those turned away to rejected.
+double service_load_test(const std::string& path, const std::vector<std::string>& addresses,
+                         unsigned int clients, unsigned int requests, int lane, unsigned int background,
+                         std::vector<double>& latencies, size_t& failures, size_t& rejected);
+
+#endif
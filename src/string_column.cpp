@@ -0,0 +1,219 @@
+#include <cmath>
+#include <cstring>
+#include <Rversion.h>
+#include "string_column.h"
+
+#if R_VERSION >= R_Version(3, 5, 0)
+#define POSTER_ALTREP
+// Older headers name a parameter class, which C++ reserves.
+#define class klass
+extern "C" {
+#include <R_ext/Altrep.h>
+}
+#undef class
+#endif
+
+static SEXP heap_string(const string_heap& heap, size_t row){
+  if(heap.is_missing(row)){
+    return NA_STRING;
+  }
+  return Rf_mkCharLenCE(heap.data(row), heap.length(row), CE_UTF8);
+}
+
+static void heap_finaliser(SEXP pointer){
+  string_heap* heap = (string_heap*) R_ExternalPtrAddr(pointer);
+  if(heap != NULL){
+    delete heap;
+    R_ClearExternalPtr(pointer);
+  }
+}
+
+// Copies heap into an ordinary character vector.
+static SEXP heap_strings(const string_heap& heap){
+  SEXP output = PROTECT(Rf_allocVector(STRSXP, heap.size()));
+  for(size_t row = 0; row < heap.size(); row++){
+    SET_STRING_ELT(output, row, heap_string(heap, row));
+  }
+  UNPROTECT(1);
+  return output;
+}
+
+#ifdef POSTER_ALTREP
+
+// A string column keeps its heap, behind an external pointer, in data1. Once
+// something asks for the vector's memory (or writes to it) the heap is copied
+// into an ordinary character vector in data2, which is used from then on.
+static R_altrep_class_t string_column_class;
+
+static string_heap& column_heap(SEXP x){
+  return *(string_heap*) R_ExternalPtrAddr(R_altrep_data1(x));
+}
+
+static SEXP materialise(SEXP x){
+  SEXP strings = R_altrep_data2(x);
+  if(strings == R_NilValue){
+    strings = PROTECT(heap_strings(column_heap(x)));
+    R_set_altrep_data2(x, strings);
+    UNPROTECT(1);
+  }
+  return strings;
+}
+
+static R_xlen_t column_length(SEXP x){
+  return column_heap(x).size();
+}
+
+static Rboolean column_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_sub)(SEXP, int, int, int)){
+  const string_heap& heap = column_heap(x);
+  Rprintf("poster_string_column (rows = %.0f, heap bytes = %.0f, %s)\n", (double) heap.size(),
+          (double) heap.bytes(), R_altrep_data2(x) == R_NilValue ? "lazy" : "materialised");
+  return TRUE;
+}
+
+static SEXP column_elt(SEXP x, R_xlen_t i){
+  SEXP strings = R_altrep_data2(x);
+  if(strings != R_NilValue){
+    return STRING_ELT(strings, i);
+  }
+  return heap_string(column_heap(x), i);
+}
+
+static void column_set_elt(SEXP x, R_xlen_t i, SEXP value){
+  SET_STRING_ELT(materialise(x), i, value);
+}
+
+static void* column_dataptr(SEXP x, Rboolean writeable){
+  return (void*) STRING_PTR_RO(materialise(x));
+}
+
+static const void* column_dataptr_or_null(SEXP x){
+  SEXP strings = R_altrep_data2(x);
+  return strings == R_NilValue ? NULL : (const void*) STRING_PTR_RO(strings);
+}
+
+static int column_no_na(SEXP x){
+  return R_altrep_data2(x) == R_NilValue && column_heap(x).missing_count() == 0;
+}
+
+// Subsets straight from the heap, rather than through an element at a time.
+static SEXP column_extract_subset(SEXP x, SEXP indices, SEXP call){
+  if(R_altrep_data2(x) != R_NilValue || (TYPEOF(indices) != INTSXP && TYPEOF(indices) != REALSXP)){
+    return NULL;
+  }
+  const string_heap& heap = column_heap(x);
+  R_xlen_t size = XLENGTH(indices);
+  SEXP output = PROTECT(Rf_allocVector(STRSXP, size));
+  for(R_xlen_t i = 0; i < size; i++){
+    double index = TYPEOF(indices) == INTSXP ?
+      (INTEGER(indices)[i] == NA_INTEGER ? NAN : INTEGER(indices)[i]) : REAL(indices)[i];
+    if(std::isnan(index) || index < 1 || index > heap.size()){
+      SET_STRING_ELT(output, i, NA_STRING);
+    } else {
+      SET_STRING_ELT(output, i, heap_string(heap, (size_t) index - 1));
+    }
+  }
+  UNPROTECT(1);
+  return output;
+}
+
+// The heap is written out as it is held: its text once, however many rows
+// share it, and each row's span, with NA lengths for missing rows. Columns
+// that have been materialised are written out as ordinary vectors.
+static SEXP column_serialized_state(SEXP x){
+  if(R_altrep_data2(x) != R_NilValue){
+    return NULL;
+  }
+  string_heap& heap = column_heap(x);
+  poster_string& text = heap.contents();
+  SEXP state = PROTECT(Rf_allocVector(VECSXP, 3));
+  SEXP contents = Rf_allocVector(RAWSXP, text.size());
+  SET_VECTOR_ELT(state, 0, contents);
+  memcpy(RAW(contents), text.data(), text.size());
+  SEXP starts = Rf_allocVector(REALSXP, heap.size());
+  SET_VECTOR_ELT(state, 1, starts);
+  SEXP lengths = Rf_allocVector(INTSXP, heap.size());
+  SET_VECTOR_ELT(state, 2, lengths);
+  for(size_t row = 0; row < heap.size(); row++){
+    REAL(starts)[row] = heap.start(row);
+    INTEGER(lengths)[row] = heap.is_missing(row) ? NA_INTEGER : (int) heap.length(row);
+  }
+  UNPROTECT(1);
+  return state;
+}
+
+// Checks state is what column_serialized_state writes, with every row's
+// span inside the text, before anything is built from it.
+static void check_state(SEXP state){
+  if(TYPEOF(state) != VECSXP || XLENGTH(state) != 3){
+    Rf_error("damaged string column: its state isn't a list of three");
+  }
+  SEXP contents = VECTOR_ELT(state, 0), starts = VECTOR_ELT(state, 1), lengths = VECTOR_ELT(state, 2);
+  if(TYPEOF(contents) != RAWSXP || TYPEOF(starts) != REALSXP || TYPEOF(lengths) != INTSXP){
+    Rf_error("damaged string column: its text, starts or lengths are of the wrong type");
+  }
+  if(XLENGTH(starts) != XLENGTH(lengths)){
+    Rf_error("damaged string column: it has %.0f starts but %.0f lengths", (double) XLENGTH(starts),
+             (double) XLENGTH(lengths));
+  }
+  double size = XLENGTH(contents);
+  for(R_xlen_t row = 0; row < XLENGTH(lengths); row++){
+    int length = INTEGER(lengths)[row];
+    if(length == NA_INTEGER){
+      continue;
+    }
+    double start = REAL(starts)[row];
+    if(length < 0 || !(start >= 0) || start != std::floor(start) || start + length > size){
+      Rf_error("damaged string column: row %.0f's text lies outside the column's", (double) row + 1);
+    }
+  }
+}
+
+static SEXP column_unserialize(SEXP klass, SEXP state){
+  check_state(state);
+  SEXP contents = VECTOR_ELT(state, 0), starts = VECTOR_ELT(state, 1), lengths = VECTOR_ELT(state, 2);
+  string_heap* heap = new string_heap(XLENGTH(lengths));
+  heap->contents().assign((const char*) RAW(contents), XLENGTH(contents));
+  for(size_t row = 0; row < heap->size(); row++){
+    int length = INTEGER(lengths)[row];
+    heap->restore(row, (uint64_t) REAL(starts)[row], length == NA_INTEGER ? string_heap::MISSING : length);
+  }
+  return make_string_column(heap);
+}
+
+void init_string_column(DllInfo* dll){
+  string_column_class = R_make_altstring_class("poster_string_column", "poster", dll);
+  R_set_altrep_Length_method(string_column_class, column_length);
+  R_set_altrep_Inspect_method(string_column_class, column_inspect);
+  R_set_altrep_Serialized_state_method(string_column_class, column_serialized_state);
+  R_set_altrep_Unserialize_method(string_column_class, column_unserialize);
+  R_set_altvec_Dataptr_method(string_column_class, column_dataptr);
+  R_set_altvec_Dataptr_or_null_method(string_column_class, column_dataptr_or_null);
+  R_set_altvec_Extract_subset_method(string_column_class, column_extract_subset);
+  R_set_altstring_Elt_method(string_column_class, column_elt);
+  R_set_altstring_Set_elt_method(string_column_class, column_set_elt);
+  R_set_altstring_No_NA_method(string_column_class, column_no_na);
+}
+
+SEXP make_string_column(string_heap* heap){
+  heap->contents().shrink_to_fit();
+  SEXP pointer = PROTECT(R_MakeExternalPtr(heap, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(pointer, heap_finaliser, TRUE);
+  SEXP column = R_new_altrep(string_column_class, pointer, R_NilValue);
+  UNPROTECT(1);
+  return column;
+}
+
+#else
+
+void init_string_column(DllInfo* dll){
+}
+
+SEXP make_string_column(string_heap* heap){
+  SEXP pointer = PROTECT(R_MakeExternalPtr(heap, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(pointer, heap_finaliser, TRUE);
+  SEXP column = heap_strings(*heap);
+  UNPROTECT(1);
+  return column;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include <Rcpp.h>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include "core.h"
+
+#ifndef __POSTER_STRING_COLUMN__
+#define __POSTER_STRING_COLUMN__
+
+// A column of strings held natively: each row is a span of one buffer, so
+// that rows repeating an earlier one can share its text.
+class string_heap {
+
+private:
+
+  poster_string text;
+  std::vector<uint64_t> starts;
+  std::vector<uint32_t> lengths;
+  size_t missing;
+
+public:
+
+  static const uint32_t MISSING = UINT32_MAX;
+
+  string_heap(size_t rows) : starts(rows, 0), lengths(rows, MISSING), missing(rows) {}
+
+  void set(size_t row, const char* data, size_t size){
+    if(lengths[row] == MISSING){
+      missing--;
+    }
+    starts[row] = text.size();
+    lengths[row] = size;
+    text.append(data, size);
+  }
+
+  // Points row at from's text, if it has any.
+  void copy(size_t row, size_t from){
+    if(lengths[from] == MISSING){
+      return;
+    }
+    if(lengths[row] == MISSING){
+      missing--;
+    }
+    starts[row] = starts[from];
+    lengths[row] = lengths[from];
+  }
+
+  // Restores a row as it was written out by contents(), starts() and lengths().
+  void restore(size_t row, uint64_t start, uint32_t length){
+    if(lengths[row] == MISSING && length != MISSING){
+      missing--;
+    }
+    starts[row] = start;
+    lengths[row] = length;
+  }
+
+  poster_string& contents(){ return text; }
+
+  size_t size() const { return lengths.size(); }
+
+  bool is_missing(size_t row) const { return lengths[row] == MISSING; }
+
+  const char* data(size_t row) const { return text.data() + starts[row]; }
+
+  uint32_t length(size_t row) const { return lengths[row]; }
+
+  uint64_t start(size_t row) const { return starts[row]; }
+
+  size_t missing_count() const { return missing; }
+
+  size_t bytes() const {
+    return text.capacity() + starts.capacity() * sizeof(uint64_t) + lengths.capacity() * sizeof(uint32_t);
+  }
+
+};
+
+// Registers the ALTREP class that string columns are, when the package loads.
+void init_string_column(DllInfo* dll);
+
+// Wraps heap, taking ownership of it, as a character vector whose elements
+// become R strings only once they are read: an ALTREP string vector, or an
+// ordinary one where R is too old to have them.
+SEXP make_string_column(string_heap* heap);
+
+#endif
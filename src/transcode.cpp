@@ -0,0 +1,74 @@
+#include <cstring>
+#include <langinfo.h>
+#include <R_ext/Riconv.h>
+#include "transcode.h"
+
+// What Windows-1252 has at 0x80-0x9F, or the C1 control where it has nothing.
+static const uint16_t windows_1252[32] = {
+  0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+  0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+  0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+  0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+};
+
+void poster_latin1_to_utf8(const char* x, size_t size, poster_string& output){
+  const unsigned char* bytes = (const unsigned char*) x;
+  size_t i = 0;
+  while(i < size){
+    size_t run = i;
+    while(run < size && bytes[run] < 0x80){
+      run++;
+    }
+    output.append(x + i, run - i);
+    if(run == size){
+      break;
+    }
+    uint32_t c = bytes[run] < 0xA0 ? windows_1252[bytes[run] - 0x80] : bytes[run];
+    if(c < 0x800){
+      output.push_back((char) (0xC0 | (c >> 6)));
+    } else {
+      output.push_back((char) (0xE0 | (c >> 12)));
+      output.push_back((char) (0x80 | ((c >> 6) & 0x3F)));
+    }
+    output.push_back((char) (0x80 | (c & 0x3F)));
+    i = run + 1;
+  }
+}
+
+bool poster_native_is_utf8(){
+  const char* codeset = nl_langinfo(CODESET);
+  return codeset != NULL && (strcmp(codeset, "UTF-8") == 0 || strcmp(codeset, "utf8") == 0);
+}
+
+native_transcoder::native_transcoder(){
+  descriptor = Riconv_open("UTF-8", "");
+  if(descriptor == (void*) -1){
+    descriptor = NULL;
+  }
+}
+
+native_transcoder::~native_transcoder(){
+  if(descriptor != NULL){
+    Riconv_close(descriptor);
+  }
+}
+
+bool native_transcoder::convert(const char* x, size_t size, poster_string& output){
+  if(descriptor == NULL){
+    return false;
+  }
+  size_t original = output.size();
+  const char* in = x;
+  size_t in_left = size;
+  // UTF-8 takes at most four bytes for any byte of a native encoding.
+  output.resize(original + size * 4 + 1);
+  char* out = &output[original];
+  size_t out_left = size * 4 + 1;
+  Riconv(descriptor, NULL, NULL, NULL, NULL);
+  if(Riconv(descriptor, &in, &in_left, &out, &out_left) == (size_t) -1){
+    output.resize(original);
+    return false;
+  }
+  output.resize(original + (size * 4 + 1) - out_left);
+  return true;
+}
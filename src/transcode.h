@@ -0,0 +1,36 @@
+#include "core.h"
+
+#ifndef __POSTER_TRANSCODE__
+#define __POSTER_TRANSCODE__
+
+// Appends the size bytes of latin1 text at x to output as UTF-8. As R does,
+// latin1 is read as Windows-1252, whose printable characters in 0x80-0x9F
+// are what latin1 text from Windows means by those bytes; the five bytes it
+// leaves undefined are kept as the C1 controls latin1 has there. Runs of
+// ASCII are copied as they are.
+void poster_latin1_to_utf8(const char* x, size_t size, poster_string& output);
+
+// Whether the native encoding, as the current locale sets it, is UTF-8.
+bool poster_native_is_utf8();
+
+// Converts text in the native encoding to UTF-8, through one iconv
+// descriptor for as many rows as it is given.
+class native_transcoder {
+
+private:
+
+  void* descriptor;
+
+public:
+
+  native_transcoder();
+
+  ~native_transcoder();
+
+  // Appends the size bytes at x, converted, to output, returning false (and
+  // leaving output as it was) if they aren't valid in the native encoding.
+  bool convert(const char* x, size_t size, poster_string& output);
+
+};
+
+#endif
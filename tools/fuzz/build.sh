@@ -0,0 +1,9 @@
+#!/bin/sh
+# Builds the fuzzing harness. Requires clang and libpostal.
+set -e
+cd "$(dirname "$0")"
+CXX=${CXX:-clang++}
+${CXX} -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined \
+  $(pkg-config --cflags libpostal) -I../../src \
+  fuzz_postal.cpp ../../src/core.cpp ../../src/instrument.cpp ../../src/metrics.cpp \
+  $(pkg-config --libs libpostal) -o fuzz_postal
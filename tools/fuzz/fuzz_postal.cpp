@@ -0,0 +1,88 @@
+// libFuzzer harness for poster's parsing and normalisation core. Besides
+// crashes, it looks for inputs that make libpostal disproportionately slow:
+// each combination of entry point and (log2) nanoseconds spent per input byte
+// is reported to libFuzzer as a feature, so an input that is slower per byte
+// than anything seen before joins the corpus and gets mutated further.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include "core.h"
+
+#define FUZZ_MODES 2
+#define FUZZ_MODE_PARSE 0
+#define FUZZ_MODE_EXPAND 1
+
+__attribute__((used, section("__libfuzzer_extra_counters")))
+static uint8_t time_features[FUZZ_MODES][64];
+
+static double slow_limit_ms = 100;
+static const char* slow_dir = NULL;
+static libpostal_address_parser_options_t parser_options;
+static libpostal_normalize_options_t normalize_options;
+
+// Keep inputs slower than POSTER_FUZZ_SLOW_MS in POSTER_FUZZ_SLOW_DIR, if set,
+// alongside how long they took; they are candidates for input guards and
+// regression benchmarks even when they don't reach libFuzzer's -timeout.
+static void keep_slow_input(int mode, const std::string& input, double elapsed_ms){
+  char path[4096];
+  unsigned long hash = 5381;
+  for(size_t i = 0; i < input.size(); i++){
+    hash = (hash * 33) ^ (unsigned char) input[i];
+  }
+  snprintf(path, sizeof(path), "%s/slow-%s-%.0fms-%016lx", slow_dir,
+           mode == FUZZ_MODE_PARSE ? "parse" : "expand", elapsed_ms, hash);
+  FILE* output = fopen(path, "wb");
+  if(output != NULL){
+    fwrite(input.data(), 1, input.size(), output);
+    fclose(output);
+  }
+}
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv){
+  if(!libpostal_setup() || !libpostal_setup_language_classifier() || !libpostal_setup_parser()){
+    fprintf(stderr, "libpostal setup failed\n");
+    exit(1);
+  }
+  parser_options = libpostal_get_address_parser_default_options();
+  normalize_options = libpostal_get_default_options();
+  if(getenv("POSTER_FUZZ_SLOW_MS") != NULL){
+    slow_limit_ms = atof(getenv("POSTER_FUZZ_SLOW_MS"));
+  }
+  slow_dir = getenv("POSTER_FUZZ_SLOW_DIR");
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size){
+
+  if(size < 1){
+    return 0;
+  }
+
+  // The first byte picks the entry point. R strings can't hold NULs, so
+  // anything after one is dropped, as it would be on the way in from R.
+  int mode = data[0] % FUZZ_MODES;
+  std::string input((const char*) data + 1, size - 1);
+  input.resize(strlen(input.c_str()));
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if(mode == FUZZ_MODE_PARSE){
+    parsed_address parsed;
+    poster_parse(input.c_str(), parser_options, parsed);
+  } else {
+    poster_string expanded;
+    poster_expand(input.c_str(), normalize_options, expanded);
+  }
+  uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+  uint64_t per_byte = elapsed / (input.size() + 1);
+  time_features[mode][63 - __builtin_clzll(per_byte | 1)] = 1;
+
+  double elapsed_ms = elapsed / 1e6;
+  if(slow_dir != NULL && elapsed_ms > slow_limit_ms){
+    keep_slow_input(mode, input, elapsed_ms);
+  }
+  return 0;
+}
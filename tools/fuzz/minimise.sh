@@ -0,0 +1,22 @@
+#!/bin/sh
+# Usage: minimise.sh CORPUS OUTPUT [SLOW_INPUT...]
+#
+# Merges CORPUS into OUTPUT, keeping the smallest set of inputs that covers
+# the same code and timing features, then shrinks each SLOW_INPUT to the
+# smallest input that still takes longer than TIMEOUT seconds (default 1),
+# writing it alongside the original with a .min suffix.
+set -e
+cd "$(dirname "$0")"
+if [ $# -lt 2 ]; then
+  echo "Usage: minimise.sh CORPUS OUTPUT [SLOW_INPUT...]" >&2
+  exit 1
+fi
+corpus=$1
+output=$2
+shift 2
+mkdir -p "${output}"
+./fuzz_postal -merge=1 "${output}" "${corpus}"
+for input in "$@"; do
+  ./fuzz_postal -minimize_crash=1 -timeout="${TIMEOUT:-1}" -runs=10000 \
+    -exact_artifact_path="${input}.min" "${input}"
+done